@@ -5,19 +5,61 @@
 #include <linux/device.h>
 #include <linux/power_supply.h>
 #include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/notifier.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 /*
  * batt_design_override: 通过 kretprobe 拦截 power_supply_get_property，
  * 在查询 POWER_SUPPLY_PROP_CHARGE_FULL_DESIGN / ENERGY_FULL_DESIGN / MODEL_NAME 时返回自定义值。
+ *
+ * 多电源：overrides 参数可配置任意条覆盖集，分号分隔，每条为 "选择器:键=值,键=值"：
+ *   overrides="bms*:design_uah=5000000,design_uwh=19350000;#battery:model_name=XYZ"
+ * 选择器支持名称（可含 * / ? 通配）、#<类型>（如 #battery 匹配所有 POWER_SUPPLY_TYPE_BATTERY）。
+ * 按声明顺序首个命中生效；都不命中时回落到 batt_name/override_any 及单值参数。
+ * 每个 power_supply 首次查询时解析一次并按指针缓存，之后每次调用为 O(1)；
+ * 配置变化或电源注销时缓存自动失效，重新注册的电源会在下一次查询时重新解析。
+ *
+ * 可选读缓存（cache_enable=1）：按 (电源, 属性) 缓存驱动返回值，命中时直接在
+ * power_supply_get_property 入口返回，不再下探到电量计驱动。设计值/型号等静态属性永久缓存，
+ * charge_full/cycle_count 按 cache_ttl 中的毫秒数过期；收到 PSY_EVENT_PROP_CHANGED 时
+ * 丢弃该电源的缓存。命中率见 cache_stats。
  * （本文件从主仓库复制，用于导出最小构建仓库）
  */
 
+/* 覆盖集/缓存失效：配置代数，任何影响匹配结果的参数变化都会递增 */
+static atomic_t cfg_gen = ATOMIC_INIT(1);
+
 static char batt_name[64] = "battery";
-module_param_string(batt_name, batt_name, sizeof(batt_name), 0644);
+static int batt_name_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_copystring(val, kp);
+    if (!ret)
+        atomic_inc(&cfg_gen);
+    return ret;
+}
+static const struct kernel_param_ops batt_name_ops = { .set = batt_name_set, .get = param_get_string };
+static struct kparam_string batt_name_kps = { .maxlen = sizeof(batt_name), .string = batt_name };
+module_param_cb(batt_name, &batt_name_ops, &batt_name_kps, 0644);
 MODULE_PARM_DESC(batt_name, "Target power_supply name (default: battery)");
 
 static bool override_any = false; /* 忽略名称匹配覆盖 */
-module_param(override_any, bool, 0644);
+static int override_any_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_bool(val, kp);
+    if (!ret)
+        atomic_inc(&cfg_gen);
+    return ret;
+}
+static const struct kernel_param_ops override_any_ops = { .set = override_any_set, .get = param_get_bool };
+module_param_cb(override_any, &override_any_ops, &override_any, 0644);
 MODULE_PARM_DESC(override_any, "Override any power_supply (default: false)");
 
 static bool verbose = true;
@@ -36,7 +78,647 @@ static char model_name[64] = ""; /* 空不覆盖 */
 module_param_string(model_name, model_name, sizeof(model_name), 0644);
 MODULE_PARM_DESC(model_name, "Override model_name (empty=no override)");
 
-struct ps_getprop_args { struct power_supply *psy; enum power_supply_property psp; union power_supply_propval *val; };
+/* ========== 多电源覆盖集 ========== */
+#define MAX_OVR_SETS 8
+#define OVR_SET_LEGACY MAX_OVR_SETS   /* 回落到 batt_name + 单值参数 */
+#define OVR_SET_NONE   (-1)
+
+struct ovr_set {
+    char sel[32];                      /* 名称/通配选择器，type 选择器时为空 */
+    int type;                          /* #<类型> 选择器的 POWER_SUPPLY_TYPE_*，-1 表示按名称 */
+    unsigned long long design_uah;     /* 0 不覆盖 */
+    unsigned long long design_uwh;     /* 0 不覆盖 */
+    char model_name[64];               /* 空不覆盖 */
+};
+
+struct ovr_cfg {
+    int nr;
+    struct ovr_set sets[MAX_OVR_SETS];
+    struct list_head retire;
+    unsigned long retired_at;          /* jiffies */
+};
+
+static struct ovr_cfg __rcu *g_cfg;
+
+/*
+ * model_name 覆盖以 val->strval 指向配置内字符串返回，调用方在 RCU 读区外格式化，
+ * 因此旧配置在替换后延迟 OVR_RETIRE_DELAY 再经一次宽限期释放。
+ */
+#define OVR_RETIRE_DELAY (5 * HZ)
+static LIST_HEAD(ovr_retired);
+static DEFINE_MUTEX(ovr_retire_lock);
+
+static void ovr_retire_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ovr_retire_work, ovr_retire_fn);
+
+static void ovr_retire_fn(struct work_struct *work)
+{
+    struct ovr_cfg *c, *tmp;
+    bool pending = false;
+
+    synchronize_rcu();
+    mutex_lock(&ovr_retire_lock);
+    list_for_each_entry_safe(c, tmp, &ovr_retired, retire) {
+        if (time_after_eq(jiffies, c->retired_at + OVR_RETIRE_DELAY)) {
+            list_del(&c->retire);
+            kfree(c);
+        } else {
+            pending = true;
+        }
+    }
+    mutex_unlock(&ovr_retire_lock);
+    if (pending)
+        schedule_delayed_work(&ovr_retire_work, OVR_RETIRE_DELAY);
+}
+
+static void ovr_retire(struct ovr_cfg *old)
+{
+    old->retired_at = jiffies;
+    mutex_lock(&ovr_retire_lock);
+    list_add_tail(&old->retire, &ovr_retired);
+    mutex_unlock(&ovr_retire_lock);
+    schedule_delayed_work(&ovr_retire_work, OVR_RETIRE_DELAY);
+}
+static char overrides[512];
+
+static const struct { const char *name; int type; } ovr_types[] = {
+    { "unknown",  POWER_SUPPLY_TYPE_UNKNOWN },
+    { "battery",  POWER_SUPPLY_TYPE_BATTERY },
+    { "ups",      POWER_SUPPLY_TYPE_UPS },
+    { "mains",    POWER_SUPPLY_TYPE_MAINS },
+    { "usb",      POWER_SUPPLY_TYPE_USB },
+    { "wireless", POWER_SUPPLY_TYPE_WIRELESS },
+};
+
+/* 简单通配：* 匹配任意串，? 匹配单字符 */
+static bool sel_match(const char *pat, const char *str)
+{
+    const char *star = NULL, *back = NULL;
+
+    while (*str) {
+        if (*pat == '*') {
+            star = ++pat;
+            back = str;
+        } else if (*pat == '?' || *pat == *str) {
+            pat++;
+            str++;
+        } else if (star) {
+            pat = star;
+            str = ++back;
+        } else {
+            return false;
+        }
+    }
+    while (*pat == '*')
+        pat++;
+    return !*pat;
+}
+
+static int parse_ovr_set(struct ovr_set *set, char *spec)
+{
+    char *sel, *kv, *val;
+    int i;
+
+    sel = strsep(&spec, ":");
+    sel = strim(sel);
+    if (!*sel || !spec)
+        return -EINVAL;
+    set->type = -1;
+    if (sel[0] == '#') {
+        for (i = 0; i < ARRAY_SIZE(ovr_types); i++) {
+            if (!strcmp(sel + 1, ovr_types[i].name)) {
+                set->type = ovr_types[i].type;
+                break;
+            }
+        }
+        if (set->type < 0 && kstrtoint(sel + 1, 10, &set->type))
+            return -EINVAL;
+    } else if (strscpy(set->sel, sel, sizeof(set->sel)) < 0) {
+        return -EINVAL;
+    }
+
+    while ((kv = strsep(&spec, ",")) != NULL) {
+        kv = strim(kv);
+        if (!*kv)
+            continue;
+        val = strchr(kv, '=');
+        if (!val)
+            return -EINVAL;
+        *val++ = '\0';
+        if (!strcmp(kv, "design_uah")) {
+            if (kstrtoull(val, 10, &set->design_uah))
+                return -EINVAL;
+        } else if (!strcmp(kv, "design_uwh")) {
+            if (kstrtoull(val, 10, &set->design_uwh))
+                return -EINVAL;
+        } else if (!strcmp(kv, "model_name")) {
+            if (strscpy(set->model_name, val, sizeof(set->model_name)) < 0)
+                return -EINVAL;
+        } else {
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static int overrides_set(const char *val, const struct kernel_param *kp)
+{
+    struct ovr_cfg *cfg, *old;
+    char *buf, *cur, *spec;
+    int ret = 0;
+
+    buf = kstrdup(val, GFP_KERNEL);
+    cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+    if (!buf || !cfg) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    cur = strim(buf);
+    while ((spec = strsep(&cur, ";")) != NULL) {
+        if (!*strim(spec))
+            continue;
+        if (cfg->nr >= MAX_OVR_SETS) {
+            ret = -E2BIG;
+            goto out;
+        }
+        ret = parse_ovr_set(&cfg->sets[cfg->nr], spec);
+        if (ret)
+            goto out;
+        cfg->nr++;
+    }
+
+    strscpy(overrides, val, sizeof(overrides));
+    old = rcu_dereference_protected(g_cfg, 1);
+    rcu_assign_pointer(g_cfg, cfg);
+    atomic_inc(&cfg_gen);
+    cfg = NULL;
+    if (old)
+        ovr_retire(old);
+out:
+    kfree(cfg);
+    kfree(buf);
+    return ret;
+}
+
+static int overrides_get(char *buffer, const struct kernel_param *kp)
+{
+    return scnprintf(buffer, PAGE_SIZE, "%s\n", overrides);
+}
+
+static const struct kernel_param_ops overrides_ops = { .set = overrides_set, .get = overrides_get };
+module_param_cb(overrides, &overrides_ops, NULL, 0644);
+MODULE_PARM_DESC(overrides, "Per-supply override sets: \"sel:key=val,...;...\" (sel: name/glob or #type)");
+
+/* ========== 读缓存：可缓存属性及其 TTL ========== */
+static bool cache_enable = false;
+module_param(cache_enable, bool, 0644);
+MODULE_PARM_DESC(cache_enable, "Serve slow power_supply properties from a TTL cache (default: false)");
+
+struct cache_prop {
+    enum power_supply_property psp;
+    const char *name;
+    int ttl_ms;                        /* <0 永久，0 不缓存 */
+    atomic_long_t hits;
+    atomic_long_t misses;
+};
+
+static struct cache_prop cache_props[] = {
+    { POWER_SUPPLY_PROP_CHARGE_FULL_DESIGN, "charge_full_design", -1 },
+    { POWER_SUPPLY_PROP_ENERGY_FULL_DESIGN, "energy_full_design", -1 },
+    { POWER_SUPPLY_PROP_VOLTAGE_MAX_DESIGN, "voltage_max_design", -1 },
+    { POWER_SUPPLY_PROP_VOLTAGE_MIN_DESIGN, "voltage_min_design", -1 },
+    { POWER_SUPPLY_PROP_TECHNOLOGY,         "technology",         -1 },
+    { POWER_SUPPLY_PROP_MODEL_NAME,         "model_name",         -1 },
+    { POWER_SUPPLY_PROP_MANUFACTURER,       "manufacturer",       -1 },
+    { POWER_SUPPLY_PROP_SERIAL_NUMBER,      "serial_number",      -1 },
+    { POWER_SUPPLY_PROP_CHARGE_FULL,        "charge_full",        10000 },
+    { POWER_SUPPLY_PROP_CYCLE_COUNT,        "cycle_count",        30000 },
+};
+#define NR_CACHE_PROPS ARRAY_SIZE(cache_props)
+
+static atomic_long_t cache_invalidations;
+
+/* 属性 -> cache_props 下标，不可缓存返回 -1（表长固定，O(1)） */
+static int cache_index(enum power_supply_property psp)
+{
+    int i;
+
+    for (i = 0; i < NR_CACHE_PROPS; i++) {
+        if (cache_props[i].psp == psp)
+            return READ_ONCE(cache_props[i].ttl_ms) ? i : -1;
+    }
+    return -1;
+}
+
+/* cache_ttl="charge_full=5000,cycle_count=60000,model_name=-1"：毫秒，-1 永久，0 关闭 */
+static int cache_ttl_set(const char *val, const struct kernel_param *kp)
+{
+    char *buf, *cur, *kv, *v;
+    int ttl[NR_CACHE_PROPS];
+    int i, ret = 0;
+
+    for (i = 0; i < NR_CACHE_PROPS; i++)
+        ttl[i] = cache_props[i].ttl_ms;
+    buf = kstrdup(val, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    cur = strim(buf);
+    while ((kv = strsep(&cur, ",")) != NULL) {
+        kv = strim(kv);
+        if (!*kv)
+            continue;
+        v = strchr(kv, '=');
+        if (!v) {
+            ret = -EINVAL;
+            goto out;
+        }
+        *v++ = '\0';
+        for (i = 0; i < NR_CACHE_PROPS; i++) {
+            if (!strcmp(kv, cache_props[i].name))
+                break;
+        }
+        if (i == NR_CACHE_PROPS || kstrtoint(v, 10, &ttl[i])) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+    /* 整体校验通过后才生效 */
+    for (i = 0; i < NR_CACHE_PROPS; i++)
+        WRITE_ONCE(cache_props[i].ttl_ms, ttl[i]);
+    atomic_inc(&cfg_gen);
+out:
+    kfree(buf);
+    return ret;
+}
+
+static int cache_ttl_get(char *buffer, const struct kernel_param *kp)
+{
+    int i, len = 0;
+
+    for (i = 0; i < NR_CACHE_PROPS; i++)
+        len += scnprintf(buffer + len, PAGE_SIZE - len, "%s%s=%d", i ? "," : "",
+                         cache_props[i].name, READ_ONCE(cache_props[i].ttl_ms));
+    len += scnprintf(buffer + len, PAGE_SIZE - len, "\n");
+    return len;
+}
+
+static const struct kernel_param_ops cache_ttl_ops = { .set = cache_ttl_set, .get = cache_ttl_get };
+module_param_cb(cache_ttl, &cache_ttl_ops, NULL, 0644);
+MODULE_PARM_DESC(cache_ttl, "Per-property cache TTL in ms: \"name=ms,...\" (-1=forever, 0=off)");
+
+static int cache_stats_get(char *buffer, const struct kernel_param *kp)
+{
+    long hits = 0, misses = 0, h, m;
+    int i, len;
+
+    for (i = 0; i < NR_CACHE_PROPS; i++) {
+        hits += atomic_long_read(&cache_props[i].hits);
+        misses += atomic_long_read(&cache_props[i].misses);
+    }
+    len = scnprintf(buffer, PAGE_SIZE, "enabled=%d hits=%ld misses=%ld hit_rate=%ld%% invalidations=%ld\n",
+                    cache_enable, hits, misses, hits + misses ? hits * 100 / (hits + misses) : 0,
+                    atomic_long_read(&cache_invalidations));
+    for (i = 0; i < NR_CACHE_PROPS; i++) {
+        h = atomic_long_read(&cache_props[i].hits);
+        m = atomic_long_read(&cache_props[i].misses);
+        if (h || m)
+            len += scnprintf(buffer + len, PAGE_SIZE - len, "%s hits=%ld misses=%ld\n",
+                             cache_props[i].name, h, m);
+    }
+    return len;
+}
+
+/* 写入任意值清零计数 */
+static int cache_stats_set(const char *val, const struct kernel_param *kp)
+{
+    int i;
+
+    for (i = 0; i < NR_CACHE_PROPS; i++) {
+        atomic_long_set(&cache_props[i].hits, 0);
+        atomic_long_set(&cache_props[i].misses, 0);
+    }
+    atomic_long_set(&cache_invalidations, 0);
+    return 0;
+}
+
+static const struct kernel_param_ops cache_stats_ops = { .set = cache_stats_set, .get = cache_stats_get };
+module_param_cb(cache_stats, &cache_stats_ops, NULL, 0644);
+MODULE_PARM_DESC(cache_stats, "Cache hit/miss counters (write anything to reset)");
+
+/* 电源 -> 覆盖集 解析缓存：按 psy 指针开放寻址，desc 指针与配置代数校验有效性 */
+#define PSY_CACHE_BITS 5
+#define PSY_CACHE_SIZE (1 << PSY_CACHE_BITS)
+
+struct psy_cached_val {
+    union power_supply_propval val;
+    unsigned long expires;             /* jiffies，ttl<0 时忽略 */
+    bool valid;
+};
+
+struct psy_slot {
+    const struct power_supply *psy;
+    const struct power_supply_desc *desc;
+    int gen;
+    int set;
+    unsigned int epoch;                /* 失效纪元：建槽/失效时取新值，0 表示无效 */
+    struct psy_cached_val vals[NR_CACHE_PROPS];  /* 驱动原始值（覆盖前） */
+};
+
+/* 纪元全局递增分配，槽位重建或移动后也不会与进行中的读取撞值 */
+static atomic_t cache_epoch_seq = ATOMIC_INIT(0);
+
+static unsigned int next_epoch(void)
+{
+    unsigned int e = atomic_inc_return(&cache_epoch_seq);
+
+    return e ? e : atomic_inc_return(&cache_epoch_seq);
+}
+
+static struct psy_slot psy_cache[PSY_CACHE_SIZE];
+static DEFINE_SPINLOCK(psy_cache_lock);
+
+static int resolve_set(const struct power_supply *psy)
+{
+    const struct power_supply_desc *desc = psy->desc;
+    struct ovr_cfg *cfg;
+    int i, set = OVR_SET_NONE;
+
+    if (!desc || !desc->name)
+        return OVR_SET_NONE;
+    rcu_read_lock();
+    cfg = rcu_dereference(g_cfg);
+    for (i = 0; cfg && i < cfg->nr; i++) {
+        if (cfg->sets[i].type >= 0 ? desc->type == cfg->sets[i].type
+                                   : sel_match(cfg->sets[i].sel, desc->name)) {
+            set = i;
+            break;
+        }
+    }
+    rcu_read_unlock();
+    if (set == OVR_SET_NONE && (override_any || !strcmp(desc->name, batt_name)))
+        set = OVR_SET_LEGACY;
+    return set;
+}
+
+/* O(1)：命中缓存直接返回；未命中则解析一次并写入缓存 */
+static int lookup_set(const struct power_supply *psy)
+{
+    unsigned int h = hash_ptr(psy, PSY_CACHE_BITS), i;
+    int gen = atomic_read(&cfg_gen), set;
+    struct psy_slot *slot, *free_slot = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&psy_cache_lock, flags);
+    for (i = 0; i < PSY_CACHE_SIZE; i++) {
+        slot = &psy_cache[(h + i) & (PSY_CACHE_SIZE - 1)];
+        if (slot->psy == psy) {
+            if (slot->desc == psy->desc && slot->gen == gen) {
+                set = slot->set;
+                spin_unlock_irqrestore(&psy_cache_lock, flags);
+                return set;
+            }
+            free_slot = slot;
+            break;
+        }
+        if (!slot->psy) {
+            free_slot = slot;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&psy_cache_lock, flags);
+
+    set = resolve_set(psy);
+
+    /* 缓存满时不缓存，仍能正确返回；解锁期间删除可能移动槽位，需重新探测 */
+    if (free_slot) {
+        spin_lock_irqsave(&psy_cache_lock, flags);
+        free_slot = NULL;
+        for (i = 0; i < PSY_CACHE_SIZE; i++) {
+            slot = &psy_cache[(h + i) & (PSY_CACHE_SIZE - 1)];
+            if (!slot->psy || slot->psy == psy) {
+                free_slot = slot;
+                break;
+            }
+        }
+        if (free_slot) {
+            free_slot->psy = psy;
+            free_slot->desc = psy->desc;
+            free_slot->gen = gen;
+            free_slot->set = set;
+            /* 配置或电源身份变化：缓存值可能含旧覆盖结果，一并丢弃 */
+            memset(free_slot->vals, 0, sizeof(free_slot->vals));
+            free_slot->epoch = next_epoch();
+        }
+        spin_unlock_irqrestore(&psy_cache_lock, flags);
+    }
+    return set;
+}
+
+/*
+ * 线性探测表的删除：把后续探测链上可前移的槽位逐个回填到空位，再清空最后的空位，
+ * 不留墓碑，反复插拔的电源（typec/无线/PD）不会逐渐占满表。调用方持锁。
+ */
+static void psy_slot_delete_locked(unsigned int hole)
+{
+    unsigned int j = hole, home;
+
+    for (;;) {
+        j = (j + 1) & (PSY_CACHE_SIZE - 1);
+        if (j == hole || !psy_cache[j].psy)
+            break;
+        home = hash_ptr(psy_cache[j].psy, PSY_CACHE_BITS);
+        /* home 位于 (hole, j] 循环区间内则该项不能前移 */
+        if (((j - home) & (PSY_CACHE_SIZE - 1)) < ((j - hole) & (PSY_CACHE_SIZE - 1)))
+            continue;
+        psy_cache[hole] = psy_cache[j];
+        hole = j;
+    }
+    memset(&psy_cache[hole], 0, sizeof(psy_cache[hole]));
+}
+
+static void forget_psy(const struct power_supply *psy)
+{
+    unsigned int h = hash_ptr(psy, PSY_CACHE_BITS), i;
+    struct psy_slot *slot;
+    unsigned long flags;
+
+    spin_lock_irqsave(&psy_cache_lock, flags);
+    for (i = 0; i < PSY_CACHE_SIZE; i++) {
+        slot = &psy_cache[(h + i) & (PSY_CACHE_SIZE - 1)];
+        if (slot->psy == psy) {
+            psy_slot_delete_locked((h + i) & (PSY_CACHE_SIZE - 1));
+            break;
+        }
+        if (!slot->psy)
+            break;
+    }
+    spin_unlock_irqrestore(&psy_cache_lock, flags);
+}
+
+/* 当前有效的槽位（调用方持锁） */
+static struct psy_slot *find_slot_locked(const struct power_supply *psy)
+{
+    unsigned int h = hash_ptr(psy, PSY_CACHE_BITS), i;
+    struct psy_slot *slot;
+
+    for (i = 0; i < PSY_CACHE_SIZE; i++) {
+        slot = &psy_cache[(h + i) & (PSY_CACHE_SIZE - 1)];
+        if (slot->psy == psy)
+            return (slot->desc == psy->desc && slot->gen == atomic_read(&cfg_gen)) ? slot : NULL;
+        if (!slot->psy)
+            return NULL;
+    }
+    return NULL;
+}
+
+static bool cache_get(const struct power_supply *psy, int ci, union power_supply_propval *val)
+{
+    struct psy_cached_val *cv;
+    struct psy_slot *slot;
+    unsigned long flags;
+    bool hit = false;
+
+    spin_lock_irqsave(&psy_cache_lock, flags);
+    slot = find_slot_locked(psy);
+    if (slot) {
+        cv = &slot->vals[ci];
+        if (cv->valid && (READ_ONCE(cache_props[ci].ttl_ms) < 0 || time_before(jiffies, cv->expires))) {
+            *val = cv->val;
+            hit = true;
+        }
+    }
+    spin_unlock_irqrestore(&psy_cache_lock, flags);
+    return hit;
+}
+
+/* 读取开始时的纪元（确保槽位存在），供 cache_put 判断期间是否发生过失效 */
+static unsigned int cache_epoch(const struct power_supply *psy)
+{
+    struct psy_slot *slot;
+    unsigned long flags;
+    unsigned int e = 0;
+
+    lookup_set(psy);
+    spin_lock_irqsave(&psy_cache_lock, flags);
+    slot = find_slot_locked(psy);
+    if (slot)
+        e = slot->epoch;
+    spin_unlock_irqrestore(&psy_cache_lock, flags);
+    return e;
+}
+
+/*
+ * 仅在条目无效/过期时写入，避免命中路径反复刷新过期时间；
+ * 纪元与读取开始时不同说明期间收到过变更通知，该值可能是旧值，丢弃。
+ */
+static void cache_put(const struct power_supply *psy, int ci, unsigned int epoch,
+                      const union power_supply_propval *val)
+{
+    int ttl = READ_ONCE(cache_props[ci].ttl_ms);
+    struct psy_cached_val *cv;
+    struct psy_slot *slot;
+    unsigned long flags;
+
+    if (!epoch)
+        return;
+    spin_lock_irqsave(&psy_cache_lock, flags);
+    slot = find_slot_locked(psy);
+    if (slot && slot->epoch == epoch) {
+        cv = &slot->vals[ci];
+        if (!cv->valid || (ttl >= 0 && !time_before(jiffies, cv->expires))) {
+            cv->val = *val;
+            cv->expires = jiffies + msecs_to_jiffies(ttl > 0 ? ttl : 0);
+            cv->valid = true;
+        }
+    }
+    spin_unlock_irqrestore(&psy_cache_lock, flags);
+}
+
+static void cache_invalidate(const struct power_supply *psy)
+{
+    struct psy_slot *slot;
+    unsigned long flags;
+
+    spin_lock_irqsave(&psy_cache_lock, flags);
+    slot = find_slot_locked(psy);
+    if (slot) {
+        memset(slot->vals, 0, sizeof(slot->vals));
+        slot->epoch = next_epoch();
+        atomic_long_inc(&cache_invalidations);
+    }
+    spin_unlock_irqrestore(&psy_cache_lock, flags);
+}
+
+static int psy_event_handler(struct notifier_block *nb, unsigned long event, void *data)
+{
+    if (event == PSY_EVENT_PROP_CHANGED && data)
+        cache_invalidate(data);
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block psy_nb = { .notifier_call = psy_event_handler };
+
+/* 覆盖值访问：set 为 OVR_SET_LEGACY 时读单值参数 */
+static unsigned long long set_design_uah(int set)
+{
+    struct ovr_cfg *cfg;
+    unsigned long long v = 0;
+
+    if (set == OVR_SET_LEGACY)
+        return design_uah;
+    rcu_read_lock();
+    cfg = rcu_dereference(g_cfg);
+    if (cfg && set >= 0 && set < cfg->nr)
+        v = cfg->sets[set].design_uah;
+    rcu_read_unlock();
+    return v;
+}
+
+static unsigned long long set_design_uwh(int set)
+{
+    struct ovr_cfg *cfg;
+    unsigned long long v = 0;
+
+    if (set == OVR_SET_LEGACY)
+        return design_uwh;
+    rcu_read_lock();
+    cfg = rcu_dereference(g_cfg);
+    if (cfg && set >= 0 && set < cfg->nr)
+        v = cfg->sets[set].design_uwh;
+    rcu_read_unlock();
+    return v;
+}
+
+/* 返回配置内字符串本身，生命周期由 ovr_retire 的延迟释放保证 */
+static const char *set_model_name(int set)
+{
+    struct ovr_cfg *cfg;
+    const char *v = NULL;
+
+    if (set == OVR_SET_LEGACY)
+        return model_name[0] ? model_name : NULL;
+    rcu_read_lock();
+    cfg = rcu_dereference(g_cfg);
+    if (cfg && set >= 0 && set < cfg->nr && cfg->sets[set].model_name[0])
+        v = cfg->sets[set].model_name;
+    rcu_read_unlock();
+    return v;
+}
+
+/* 电源注销时丢弃缓存，防止指针复用后命中旧的解析结果 */
+static struct kprobe psy_unreg_kprobe;
+
+static int psy_unreg_pre(struct kprobe *p, struct pt_regs *regs)
+{
+#if defined(CONFIG_ARM64)
+    struct power_supply *psy = (struct power_supply *)regs->regs[0];
+    if (psy)
+        forget_psy(psy);
+#endif
+    return 0;
+}
+
+struct ps_getprop_args { struct power_supply *psy; enum power_supply_property psp; union power_supply_propval *val; unsigned int epoch; };
 static struct kretprobe ps_getprop_kretprobe;
 
 struct ps_show_args { struct device *dev; struct device_attribute *da; char *buf; };
@@ -49,6 +731,8 @@ static int entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
     args->psy = (struct power_supply *)regs->regs[0];
     args->psp = (enum power_supply_property)regs->regs[1];
     args->val = (union power_supply_propval *)regs->regs[2];
+    /* 在驱动读取前记下纪元，返回时据此判断读取期间是否被失效 */
+    args->epoch = (cache_enable && args->psy && cache_index(args->psp) >= 0) ? cache_epoch(args->psy) : 0;
     if (args->psy && verbose && args->psy->desc) {
         if (args->psp == POWER_SUPPLY_PROP_CHARGE_FULL_DESIGN ||
             args->psp == POWER_SUPPLY_PROP_ENERGY_FULL_DESIGN ||
@@ -60,35 +744,95 @@ static int entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
     return 0;
 }
 
-static int ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
+/* 对 get_property 结果应用覆盖（驱动返回或缓存命中后均走这里） */
+static void apply_override(struct power_supply *psy, enum power_supply_property psp, union power_supply_propval *val)
 {
-    struct ps_getprop_args *args = (struct ps_getprop_args *)ri->data;
-    if (!args || !args->psy || !args->val) return 0;
-#if defined(CONFIG_ARM64)
-    if (regs_return_value(regs)) return 0;
-#endif
-    if (args->psp == POWER_SUPPLY_PROP_CHARGE_FULL_DESIGN) {
-        if (((override_any && design_uah > 0) || (args->psy->desc && !strcmp(args->psy->desc->name, batt_name) && design_uah > 0))) {
+    const char *name, *model;
+    unsigned long long v;
+    int set;
+
+    if (psp != POWER_SUPPLY_PROP_CHARGE_FULL_DESIGN &&
+        psp != POWER_SUPPLY_PROP_ENERGY_FULL_DESIGN &&
+        psp != POWER_SUPPLY_PROP_MODEL_NAME)
+        return;
+    set = lookup_set(psy);
+    if (set == OVR_SET_NONE) return;
+    name = psy->desc ? psy->desc->name : "<null>";
+    if (psp == POWER_SUPPLY_PROP_CHARGE_FULL_DESIGN) {
+        v = set_design_uah(set);
+        if (v > 0) {
             if (verbose)
-                pr_info("batt_design_override: CHARGE_FULL_DESIGN -> %llu uAh (%s)\n", design_uah, args->psy->desc ? args->psy->desc->name : "<null>");
-            args->val->intval = (int)design_uah;
+                pr_info("batt_design_override: CHARGE_FULL_DESIGN -> %llu uAh (%s)\n", v, name);
+            val->intval = (int)v;
         }
-    } else if (args->psp == POWER_SUPPLY_PROP_ENERGY_FULL_DESIGN) {
-        if (((override_any && design_uwh > 0) || (args->psy->desc && !strcmp(args->psy->desc->name, batt_name) && design_uwh > 0))) {
+    } else if (psp == POWER_SUPPLY_PROP_ENERGY_FULL_DESIGN) {
+        v = set_design_uwh(set);
+        if (v > 0) {
             if (verbose)
-                pr_info("batt_design_override: ENERGY_FULL_DESIGN -> %llu uWh (%s)\n", design_uwh, args->psy->desc ? args->psy->desc->name : "<null>");
-            args->val->intval = (int)design_uwh;
+                pr_info("batt_design_override: ENERGY_FULL_DESIGN -> %llu uWh (%s)\n", v, name);
+            val->intval = (int)v;
         }
-    } else if (args->psp == POWER_SUPPLY_PROP_MODEL_NAME) {
-        if (((override_any && model_name[0] != '\0') || (args->psy->desc && !strcmp(args->psy->desc->name, batt_name) && model_name[0] != '\0'))) {
+    } else {
+        model = set_model_name(set);
+        if (model) {
             if (verbose)
-                pr_info("batt_design_override: MODEL_NAME -> %s (%s)\n", model_name, args->psy->desc ? args->psy->desc->name : "<null>");
-            args->val->strval = model_name;
+                pr_info("batt_design_override: MODEL_NAME -> %s (%s)\n", model, name);
+            val->strval = model;
         }
     }
+}
+
+static int ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+    struct ps_getprop_args *args = (struct ps_getprop_args *)ri->data;
+    int ci;
+    if (!args || !args->psy || !args->val) return 0;
+#if defined(CONFIG_ARM64)
+    if (regs_return_value(regs)) return 0;
+#endif
+    /* 先缓存驱动原始值，再覆盖 */
+    if (cache_enable) {
+        ci = cache_index(args->psp);
+        if (ci >= 0)
+            cache_put(args->psy, ci, args->epoch, args->val);
+    }
+    apply_override(args->psy, args->psp, args->val);
     return 0;
 }
 
+/*
+ * 读缓存入口：命中时填入缓存值并应用覆盖，置返回值 0 后直接跳回调用者
+ * （pc = lr，pre_handler 返回 1 跳过单步），驱动的 get_property 不会被调用。
+ */
+static struct kprobe getprop_cache_kprobe;
+
+static int getprop_cache_pre(struct kprobe *p, struct pt_regs *regs)
+{
+#if defined(CONFIG_ARM64)
+    struct power_supply *psy = (struct power_supply *)regs->regs[0];
+    enum power_supply_property psp = (enum power_supply_property)regs->regs[1];
+    union power_supply_propval *val = (union power_supply_propval *)regs->regs[2];
+    int ci;
+
+    if (!cache_enable || !psy || !val)
+        return 0;
+    ci = cache_index(psp);
+    if (ci < 0)
+        return 0;
+    if (!cache_get(psy, ci, val)) {
+        atomic_long_inc(&cache_props[ci].misses);
+        return 0;
+    }
+    atomic_long_inc(&cache_props[ci].hits);
+    apply_override(psy, psp, val);
+    regs->regs[0] = 0;
+    instruction_pointer_set(regs, regs->regs[30]);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 static int show_entry_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
 #if defined(CONFIG_ARM64)
@@ -107,39 +851,52 @@ static int show_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
     struct ps_show_args *args = (struct ps_show_args *)ri->data;
     const char *attr;
     struct power_supply *psy;
-    const char *name;
+    const char *name, *model;
+    unsigned long long v;
     ssize_t newlen;
+    int set;
 
     if (!args || !args->dev || !args->da || !args->buf)
         return 0;
     attr = args->da->attr.name;
     if (!attr)
         return 0;
+    if (strcmp(attr, "charge_full_design") && strcmp(attr, "energy_full_design") &&
+        strcmp(attr, "model_name"))
+        return 0;
     psy = dev_get_drvdata(args->dev);
-    name = (psy && psy->desc) ? psy->desc->name : NULL;
+    if (!psy)
+        return 0;
+    set = lookup_set(psy);
+    if (set == OVR_SET_NONE)
+        return 0;
+    name = psy->desc ? psy->desc->name : NULL;
     if (!strcmp(attr, "charge_full_design")) {
-        if (((override_any && design_uah>0) || (name && !strcmp(name,batt_name) && design_uah>0))) {
-            newlen = scnprintf(args->buf, PAGE_SIZE, "%llu\n", design_uah);
+        v = set_design_uah(set);
+        if (v > 0) {
+            newlen = scnprintf(args->buf, PAGE_SIZE, "%llu\n", v);
 #if defined(CONFIG_ARM64)
             regs->regs[0] = (unsigned long)newlen;
 #endif
-            if (verbose) pr_info("batt_design_override: show charge_full_design %s -> %llu\n", name?name:"<null>", design_uah);
+            if (verbose) pr_info("batt_design_override: show charge_full_design %s -> %llu\n", name?name:"<null>", v);
         }
     } else if (!strcmp(attr, "energy_full_design")) {
-        if (((override_any && design_uwh>0) || (name && !strcmp(name,batt_name) && design_uwh>0))) {
-            newlen = scnprintf(args->buf, PAGE_SIZE, "%llu\n", design_uwh);
+        v = set_design_uwh(set);
+        if (v > 0) {
+            newlen = scnprintf(args->buf, PAGE_SIZE, "%llu\n", v);
 #if defined(CONFIG_ARM64)
             regs->regs[0] = (unsigned long)newlen;
 #endif
-            if (verbose) pr_info("batt_design_override: show energy_full_design %s -> %llu\n", name?name:"<null>", design_uwh);
+            if (verbose) pr_info("batt_design_override: show energy_full_design %s -> %llu\n", name?name:"<null>", v);
         }
-    } else if (!strcmp(attr, "model_name")) {
-        if (((override_any && model_name[0]) || (name && !strcmp(name,batt_name) && model_name[0]))) {
-            newlen = scnprintf(args->buf, PAGE_SIZE, "%s\n", model_name);
+    } else {
+        model = set_model_name(set);
+        if (model) {
+            newlen = scnprintf(args->buf, PAGE_SIZE, "%s\n", model);
 #if defined(CONFIG_ARM64)
             regs->regs[0] = (unsigned long)newlen;
 #endif
-            if (verbose) pr_info("batt_design_override: show model_name %s -> %s\n", name?name:"<null>", model_name);
+            if (verbose) pr_info("batt_design_override: show model_name %s -> %s\n", name?name:"<null>", model);
         }
     }
     return 0;
@@ -166,14 +923,47 @@ static int __init batt_override_init(void)
     ret = register_kretprobe(&ps_show_kretprobe);
     if (ret) { pr_err("batt_design_override: register show kretprobe failed %d\n", ret); unregister_kretprobe(&ps_getprop_kretprobe); return ret; }
 
-    pr_info("batt_design_override: loaded (batt_name=%s design_uah=%llu design_uwh=%llu model_name=%s)\n", batt_name, design_uah, design_uwh, model_name[0]?model_name:"<none>");
+    /* 注销探测失败不致命：缓存仍按 desc/代数校验，只是指针复用时可能沿用旧解析 */
+    memset(&psy_unreg_kprobe, 0, sizeof(psy_unreg_kprobe));
+    psy_unreg_kprobe.pre_handler = psy_unreg_pre;
+    psy_unreg_kprobe.symbol_name = "power_supply_unregister";
+    ret = register_kprobe(&psy_unreg_kprobe);
+    if (ret) { pr_warn("batt_design_override: register unregister kprobe failed %d\n", ret); psy_unreg_kprobe.addr = NULL; }
+
+    /* 读缓存入口与失效通知；失败时仅禁用缓存，不影响覆盖功能 */
+    memset(&getprop_cache_kprobe, 0, sizeof(getprop_cache_kprobe));
+    getprop_cache_kprobe.pre_handler = getprop_cache_pre;
+    getprop_cache_kprobe.symbol_name = "power_supply_get_property";
+    ret = register_kprobe(&getprop_cache_kprobe);
+    if (ret) { pr_warn("batt_design_override: register cache kprobe failed %d, cache disabled\n", ret); getprop_cache_kprobe.addr = NULL; }
+    ret = power_supply_reg_notifier(&psy_nb);
+    if (ret) {
+        pr_warn("batt_design_override: reg notifier failed %d, cache disabled\n", ret);
+        psy_nb.notifier_call = NULL;
+        if (getprop_cache_kprobe.addr) { unregister_kprobe(&getprop_cache_kprobe); getprop_cache_kprobe.addr = NULL; }
+    }
+
+    pr_info("batt_design_override: loaded (batt_name=%s design_uah=%llu design_uwh=%llu model_name=%s overrides=%s)\n", batt_name, design_uah, design_uwh, model_name[0]?model_name:"<none>", overrides[0]?overrides:"<none>");
     return 0;
 }
 
 static void __exit batt_override_exit(void)
 {
+    struct ovr_cfg *c, *tmp;
+
     unregister_kretprobe(&ps_getprop_kretprobe);
     unregister_kretprobe(&ps_show_kretprobe);
+    if (psy_nb.notifier_call)
+        power_supply_unreg_notifier(&psy_nb);
+    if (getprop_cache_kprobe.addr)
+        unregister_kprobe(&getprop_cache_kprobe);
+    if (psy_unreg_kprobe.addr)
+        unregister_kprobe(&psy_unreg_kprobe);
+    cancel_delayed_work_sync(&ovr_retire_work);
+    synchronize_rcu();
+    list_for_each_entry_safe(c, tmp, &ovr_retired, retire)
+        kfree(c);
+    kfree(rcu_dereference_protected(g_cfg, 1));
     pr_info("batt_design_override: unloaded\n");
 }
 
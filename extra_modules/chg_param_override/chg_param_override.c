@@ -14,6 +14,8 @@
 #include <linux/workqueue.h>
 #include <linux/version.h>
 #include <linux/kmod.h>
+#include <linux/ctype.h>
+#include <linux/string.h>
 #include <linux/notifier.h>
 #include <linux/workqueue.h>
 
@@ -35,19 +37,22 @@
  *    并在 set_property 路径通过 kprobe/kretprobe 劫持（若目标符号可见）
  *
  * 为兼容性，本实现先提供一个简洁的 proc 接口：/proc/chg_param_override
- * 用户可写入 JSON 风格的简单键值：
- *   {"voltage_max": 4460000, "constant_charge_current": 6000000, "input_current_limit": 1500000, "pd_verifed": 1}
- * 或使用简写行： key=value 换行分隔
+ * 写入 key=value 换行分隔的一批参数（键名见 chg_keys 表）：
+ * - 整批先校验后提交，任一行非法则整批返回 -EINVAL，已有配置不变
+ * - 可附带 gen=<n>：仅当 n 等于读取到的 gen 时提交，否则返回 -EAGAIN
+ * - 提交后只对本批涉及的键单遍调用 set_property
+ * 读取输出 version=/gen= 及全部键的当前值。
  */
  
 
-static char target_batt[32] = "battery";
+/* 支持逗号分隔的多个电源名，如双电芯 "battery,bms"、多输入 "usb,wireless,dc,pc_port" */
+static char target_batt[64] = "battery";
 module_param_string(target_batt, target_batt, sizeof(target_batt), 0644);
-MODULE_PARM_DESC(target_batt, "power_supply name for battery (default: battery)");
+MODULE_PARM_DESC(target_batt, "power_supply name(s) for battery, comma separated (default: battery)");
 
-static char target_usb[16] = "usb";
+static char target_usb[64] = "usb";
 module_param_string(target_usb, target_usb, sizeof(target_usb), 0644);
-MODULE_PARM_DESC(target_usb, "power_supply name for usb (default: usb)");
+MODULE_PARM_DESC(target_usb, "power_supply name(s) for input, comma separated (default: usb)");
 
 static bool verbose = true;
 module_param(verbose, bool, 0644);
@@ -82,20 +87,126 @@ struct chg_targets {
 static struct chg_targets g_targets;
 static DEFINE_MUTEX(g_lock);
 
+/* 控制接口版本：proc_read 输出 version=，格式不兼容变更时递增 */
+#define CHG_CTL_VERSION 2
+
+/* 配置代数：每次成功提交 +1，写入 gen=<n> 时作为 compare-and-swap 条件 */
+static u64 g_gen;
+
+/*
+ * 一次写入的暂存区：proc_write 先在副本上解析/校验整批键值，
+ * 全部通过后才一次性提交到 g_targets / target_batt / target_usb。
+ */
+struct chg_txn {
+    struct chg_targets t;
+    char batt[sizeof(target_batt)];
+    char usb[sizeof(target_usb)];
+    unsigned long dirty;               /* 本批写入涉及的键（按 chg_keys 下标） */
+    bool has_gen;
+    u64 expect_gen;
+};
+
+enum chg_key_type {
+    CHG_KEY_INT,                       /* 整数，按 min/max 校验 */
+    CHG_KEY_STR,                       /* 字符串（power_supply 名称） */
+    CHG_KEY_FLAG,                      /* 仅置位 flag_off，值被忽略 */
+};
+
+enum chg_key_psy {
+    CHG_PSY_NONE,
+    CHG_PSY_BATT,
+    CHG_PSY_USB,
+};
+
+/* 单一键表：解析、校验、proc_read 输出与 apply 均由此表驱动 */
+struct chg_key {
+    const char *name;                  /* 规范键名（proc_read 输出） */
+    const char *alias;                 /* 兼容别名，可为 NULL */
+    enum chg_key_type type;
+    size_t off;                        /* struct chg_txn 内偏移 */
+    size_t len;                        /* CHG_KEY_STR 缓冲长度 */
+    int min, max;
+    size_t flag_off;                   /* 写入时同步置位的 bool（0=无） */
+    bool flag_val;
+    enum chg_key_psy psy;              /* apply 目标电源 */
+    enum power_supply_property psp;
+};
+
+#define TXN_OFF(f) offsetof(struct chg_txn, f)
+
+enum chg_key_id {
+    CHG_K_BATT,
+    CHG_K_USB,
+    CHG_K_VMAX,
+    CHG_K_CCC,
+    CHG_K_TERM,
+    CHG_K_ICL,
+    CHG_K_LIMIT,
+    CHG_K_PD,
+    CHG_K_PD_DISABLE,
+    CHG_NR_KEYS
+};
+
+static const struct chg_key chg_keys[CHG_NR_KEYS] = {
+    [CHG_K_BATT] = { "batt", NULL, CHG_KEY_STR, TXN_OFF(batt), sizeof(target_batt) },
+    [CHG_K_USB]  = { "usb",  NULL, CHG_KEY_STR, TXN_OFF(usb),  sizeof(target_usb) },
+    [CHG_K_VMAX] = { "voltage_max", NULL, CHG_KEY_INT, TXN_OFF(t.voltage_max_uv), 0, 0, INT_MAX,
+                     0, false, CHG_PSY_BATT, POWER_SUPPLY_PROP_VOLTAGE_MAX },
+    [CHG_K_CCC]  = { "ccc", "constant_charge_current", CHG_KEY_INT, TXN_OFF(t.constant_charge_current_ua),
+                     0, 0, INT_MAX, 0, false, CHG_PSY_BATT, POWER_SUPPLY_PROP_CONSTANT_CHARGE_CURRENT },
+    [CHG_K_TERM] = { "term", "charge_term_current", CHG_KEY_INT, TXN_OFF(t.term_current_ua),
+                     0, 0, INT_MAX, 0, false, CHG_PSY_BATT, POWER_SUPPLY_PROP_CHARGE_TERM_CURRENT },
+    [CHG_K_ICL]  = { "icl", "input_current_limit", CHG_KEY_INT, TXN_OFF(t.usb_input_current_limit_ua),
+                     0, 0, INT_MAX, 0, false, CHG_PSY_USB, POWER_SUPPLY_PROP_INPUT_CURRENT_LIMIT },
+    [CHG_K_LIMIT] = { "charge_limit", "charge_control_limit", CHG_KEY_INT, TXN_OFF(t.charge_control_limit_percent),
+                      0, 0, 100, 0, false, CHG_PSY_BATT, POWER_SUPPLY_PROP_CHARGE_CONTROL_LIMIT },
+    [CHG_K_PD]   = { "pd_verifed", NULL, CHG_KEY_INT, TXN_OFF(t.pd_verifed), 0, 0, 1,
+                     TXN_OFF(t.pd_verifed_enabled), true },
+    [CHG_K_PD_DISABLE] = { "pd_verifed_disable", NULL, CHG_KEY_FLAG, 0, 0, 0, 0,
+                           TXN_OFF(t.pd_verifed_enabled), false },
+};
+
+/* 已提交配置中某整数键的当前值 */
+#define CHG_TARGET_INT(k) (*(int *)((char *)&g_targets + (k)->off - TXN_OFF(t)))
+
+#define CHG_APPLY_ALL   (BIT(CHG_NR_KEYS) - 1)
+/* 电源名称变化后需对新目标重写全部参数 */
+#define CHG_NAME_KEYS   (BIT(CHG_K_BATT) | BIT(CHG_K_USB))
+
 /* 事件驱动自动重写：power_supply 通知 + 延迟工作合并写入 */
 static struct notifier_block psy_nb;
 static struct delayed_work reapply_work;
 
 /* 前向声明，供工作队列回调调用 */
-static int apply_targets_locked(void);
+static int apply_targets_locked(unsigned long mask);
 
 static void reapply_work_fn(struct work_struct *work)
 {
     mutex_lock(&g_lock);
-    (void)apply_targets_locked();
+    (void)apply_targets_locked(CHG_APPLY_ALL);
     mutex_unlock(&g_lock);
 }
 
+/* name 是否在逗号分隔的电源名列表中（各项去除首尾空白，与 apply_psy_list 一致） */
+static bool name_in_list(const char *name, const char *list)
+{
+    size_t n = strlen(name);
+    const char *p = list, *end, *e;
+
+    for (;;) {
+        end = strchrnul(p, ',');
+        p = skip_spaces(p);
+        e = end;
+        while (e > p && isspace(e[-1]))
+            e--;
+        if ((size_t)(e - p) == n && !strncmp(p, name, n))
+            return true;
+        if (!*end)
+            return false;
+        p = end + 1;
+    }
+}
+
 static int psy_event_handler(struct notifier_block *nb, unsigned long event, void *data)
 {
     struct power_supply *psy = data;
@@ -109,7 +220,7 @@ static int psy_event_handler(struct notifier_block *nb, unsigned long event, voi
         return NOTIFY_DONE;
 
     /* 仅对我们关心的电源触发，合并频繁事件避免抖动 */
-    if (!strcmp(name, target_batt) || !strcmp(name, target_usb)) {
+    if (name_in_list(name, target_batt) || name_in_list(name, target_usb)) {
         schedule_delayed_work(&reapply_work, msecs_to_jiffies(200));
         return NOTIFY_OK;
     }
@@ -178,148 +289,170 @@ static int write_psy_int(struct power_supply *psy, enum power_supply_property ps
     return ret;
 }
 
-static int apply_targets_locked(void)
+/* 对列表中的每个电源写入 kind 类键中 mask 涉及的值，每个电源只查找一次 */
+static void apply_psy_list(const char *list, enum chg_key_psy kind, unsigned long mask)
 {
-    int ret = 0, rc;
-    struct power_supply *batt = NULL, *usb = NULL;
+    char names[sizeof(target_batt)], *cur, *name;
+    const struct chg_key *k;
+    struct power_supply *psy;
+    int rc, val, i;
+
+    strscpy(names, list, sizeof(names));
+    cur = names;
+    while ((name = strsep(&cur, ",")) != NULL) {
+        name = strim(name);
+        if (!*name)
+            continue;
+        psy = find_psy_by_name(name);
+        if (!psy)
+            continue;
+        for (i = 0; i < CHG_NR_KEYS; i++) {
+            k = &chg_keys[i];
+            if (k->psy != kind || !(mask & BIT(i)))
+                continue;
+            val = CHG_TARGET_INT(k);
+            if (val <= 0)
+                continue;
+            rc = write_psy_int(psy, k->psp, val);
+            if (rc && verbose)
+                pr_info("chg_param_override: set %s on %s failed %d\n", k->name, name, rc);
+        }
+        power_supply_put(psy);
+    }
+}
 
+/* 按 mask（chg_keys 下标位图）单遍应用：未涉及的键不触碰驱动 */
+static int apply_targets_locked(unsigned long mask)
+{
     /* 应用 PD Verified 设置（若启用且未禁用该特性） */
 #if !DISABLE_PD_VERIFED
-    if (g_targets.pd_verifed_enabled) {
+    int rc;
+    if (g_targets.pd_verifed_enabled && (mask & BIT(CHG_K_PD))) {
         rc = set_pd_verifed(g_targets.pd_verifed);
         if (rc && verbose)
             pr_info("chg_param_override: set pd_verifed failed %d\n", rc);
     }
 #endif
 
-    batt = find_psy_by_name(target_batt);
-    usb  = find_psy_by_name(target_usb);
-
-    if (batt) {
-        if (g_targets.voltage_max_uv > 0) {
-            rc = write_psy_int(batt, POWER_SUPPLY_PROP_VOLTAGE_MAX, g_targets.voltage_max_uv);
-            if (rc && verbose)
-                pr_info("chg_param_override: set VMAX failed %d\n", rc);
-        }
-        if (g_targets.constant_charge_current_ua > 0) {
-            rc = write_psy_int(batt, POWER_SUPPLY_PROP_CONSTANT_CHARGE_CURRENT,
-                               g_targets.constant_charge_current_ua);
-            if (rc && verbose)
-                pr_info("chg_param_override: set CCC failed %d\n", rc);
-        }
-        if (g_targets.term_current_ua > 0) {
-            rc = write_psy_int(batt, POWER_SUPPLY_PROP_CHARGE_TERM_CURRENT,
-                               g_targets.term_current_ua);
-            if (rc && verbose)
-                pr_info("chg_param_override: set TERM failed %d\n", rc);
-        }
-        if (g_targets.charge_control_limit_percent > 0) {
-            rc = write_psy_int(batt, POWER_SUPPLY_PROP_CHARGE_CONTROL_LIMIT,
-                               g_targets.charge_control_limit_percent);
-            if (rc && verbose)
-                pr_info("chg_param_override: set charge_control_limit failed %d\n", rc);
-        }
-    }
-
-    if (usb) {
-        if (g_targets.usb_input_current_limit_ua > 0) {
-            rc = write_psy_int(usb, POWER_SUPPLY_PROP_INPUT_CURRENT_LIMIT,
-                               g_targets.usb_input_current_limit_ua);
-            if (rc && verbose)
-                pr_info("chg_param_override: set ICL failed %d\n", rc);
-        }
-    }
-    if (batt)
-        power_supply_put(batt);
-    if (usb)
-        power_supply_put(usb);
-    return ret;
+    if (mask & (BIT(CHG_K_VMAX) | BIT(CHG_K_CCC) | BIT(CHG_K_TERM) | BIT(CHG_K_LIMIT)))
+        apply_psy_list(target_batt, CHG_PSY_BATT, mask);
+    if (mask & BIT(CHG_K_ICL))
+        apply_psy_list(target_usb, CHG_PSY_USB, mask);
+    return 0;
 }
 
 /* ========== procfs 接口 ========== */
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 static struct proc_dir_entry *proc_entry;
 
-static ssize_t proc_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+static int proc_show(struct seq_file *m, void *v)
 {
-    char kbuf[512];
-    int len;
-    if (*ppos)
-        return 0;
+    const struct chg_key *k;
+    int i;
+
     mutex_lock(&g_lock);
-    len = scnprintf(kbuf, sizeof(kbuf),
-        "batt=%s usb=%s\n"
-        "voltage_max=%d\n"
-        "ccc=%d\n"
-        "term=%d\n"
-        "icl=%d\n"
-        "auto_reapply=%s\n",
-        target_batt, target_usb,
-        g_targets.voltage_max_uv,
-        g_targets.constant_charge_current_ua,
-        g_targets.term_current_ua,
-        g_targets.usb_input_current_limit_ua,
-        auto_reapply ? "yes" : "no");
+    seq_printf(m, "batt=%s usb=%s\n", target_batt, target_usb);
+    seq_printf(m, "version=%d\n", CHG_CTL_VERSION);
+    seq_printf(m, "gen=%llu\n", g_gen);
+    for (i = 0; i < CHG_NR_KEYS; i++) {
+        k = &chg_keys[i];
+        if (k->type != CHG_KEY_INT)
+            continue;
+        seq_printf(m, "%s=%d\n", k->name, CHG_TARGET_INT(k));
+    }
+    seq_printf(m, "pd_verifed_enabled=%d\n", g_targets.pd_verifed_enabled);
+    seq_printf(m, "auto_reapply=%s\n", auto_reapply ? "yes" : "no");
     mutex_unlock(&g_lock);
-    if (len > count)
-        len = count;
-    if (copy_to_user(buf, kbuf, len))
-        return -EFAULT;
-    *ppos += len;
-    return len;
+    return 0;
+}
+
+static int proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, proc_show, NULL);
+}
+
+static const struct chg_key *find_key(const char *key)
+{
+    int i;
+
+    for (i = 0; i < CHG_NR_KEYS; i++) {
+        if (!strcmp(key, chg_keys[i].name) ||
+            (chg_keys[i].alias && !strcmp(key, chg_keys[i].alias)))
+            return &chg_keys[i];
+    }
+    return NULL;
 }
 
-static int parse_kv(const char *key, const char *val)
+/* 仅写入暂存区 txn，不触碰全局状态 */
+static int parse_kv(struct chg_txn *txn, const char *key, const char *val)
 {
+    const struct chg_key *k;
     int v;
-    if (!strcmp(key, "voltage_max") && kstrtoint(val, 10, &v) == 0) {
-        g_targets.voltage_max_uv = v;
-    } else if ((!strcmp(key, "constant_charge_current") || !strcmp(key, "ccc")) && kstrtoint(val, 10, &v) == 0) {
-        g_targets.constant_charge_current_ua = v;
-    } else if ((!strcmp(key, "term") || !strcmp(key, "charge_term_current")) && kstrtoint(val, 10, &v) == 0) {
-        g_targets.term_current_ua = v;
-    } else if ((!strcmp(key, "icl") || !strcmp(key, "input_current_limit")) && kstrtoint(val, 10, &v) == 0) {
-        g_targets.usb_input_current_limit_ua = v;
-    } else if ((!strcmp(key, "charge_limit") || !strcmp(key, "charge_control_limit")) && kstrtoint(val, 10, &v) == 0) {
-        if (v >= 0 && v <= 100) {
-            g_targets.charge_control_limit_percent = v;
-        } else {
-            return -EINVAL;
-        }
-    } else if (!strcmp(key, "pd_verifed") && kstrtoint(val, 10, &v) == 0) {
-        if (v == 0 || v == 1) {
-            g_targets.pd_verifed = v;
-            g_targets.pd_verifed_enabled = true;
-        } else {
+
+    if (!strcmp(key, "gen")) {
+        if (kstrtoull(val, 10, &txn->expect_gen))
             return -EINVAL;
-        }
-    } else if (!strcmp(key, "pd_verifed_disable")) {
-        g_targets.pd_verifed_enabled = false;
-    } else if (!strcmp(key, "batt")) {
-        strlcpy(target_batt, val, sizeof(target_batt));
-    } else if (!strcmp(key, "usb")) {
-        strlcpy(target_usb, val, sizeof(target_usb));
-    } else {
+        txn->has_gen = true;
+        return 0;
+    }
+
+    k = find_key(key);
+    if (!k)
         return -EINVAL;
+
+    switch (k->type) {
+    case CHG_KEY_INT:
+        if (kstrtoint(val, 10, &v) || v < k->min || v > k->max)
+            return -EINVAL;
+        *(int *)((char *)txn + k->off) = v;
+        break;
+    case CHG_KEY_STR:
+        if (!*val || strlen(val) >= k->len)
+            return -EINVAL;
+        strscpy((char *)txn + k->off, val, k->len);
+        /* 名称与已提交值相同不算改动，避免每次整表保存都升级为全量重应用 */
+        if (!strcmp(val, k - chg_keys == CHG_K_BATT ? target_batt : target_usb))
+            return 0;
+        break;
+    case CHG_KEY_FLAG:
+        break;
     }
+    if (k->flag_off)
+        *(bool *)((char *)txn + k->flag_off) = k->flag_val;
+    txn->dirty |= BIT(k - chg_keys);
     return 0;
 }
 
+/*
+ * 整批事务：先在暂存副本上解析校验全部行，任一行失败则整批拒绝且不改动现有配置；
+ * 带 gen=<n> 时仅当 n 等于当前代数才提交（否则 -EAGAIN，调用方应重读后重试）。
+ */
 static ssize_t proc_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 {
     char *kbuf, *line, *kv, *val;
+    struct chg_txn *txn;
+    unsigned long mask;
     int rc = 0;
     if (count == 0 || count > PAGE_SIZE)
         return -EINVAL;
     kbuf = kzalloc(count + 1, GFP_KERNEL);
     if (!kbuf)
         return -ENOMEM;
-    if (copy_from_user(kbuf, buf, count)) {
+    txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+    if (!txn) {
         kfree(kbuf);
-        return -EFAULT;
+        return -ENOMEM;
+    }
+    if (copy_from_user(kbuf, buf, count)) {
+        rc = -EFAULT;
+        goto out;
     }
     mutex_lock(&g_lock);
+    txn->t = g_targets;
+    strscpy(txn->batt, target_batt, sizeof(txn->batt));
+    strscpy(txn->usb, target_usb, sizeof(txn->usb));
     line = strim(kbuf);
     while (line && *line) {
         kv = strsep(&line, "\n");
@@ -335,13 +468,26 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t coun
         }
         *val = '\0';
         val++;
-        rc = parse_kv(kv, val);
-        if (rc)
+        rc = parse_kv(txn, strim(kv), strim(val));
+        if (rc) {
+            if (verbose)
+                pr_info("chg_param_override: rejected batch at key '%s'\n", kv);
             break;
+        }
+    }
+    if (!rc && txn->has_gen && txn->expect_gen != g_gen)
+        rc = -EAGAIN;
+    if (!rc && txn->dirty) {
+        g_targets = txn->t;
+        strscpy(target_batt, txn->batt, sizeof(target_batt));
+        strscpy(target_usb, txn->usb, sizeof(target_usb));
+        g_gen++;
+        mask = (txn->dirty & CHG_NAME_KEYS) ? CHG_APPLY_ALL : txn->dirty;
+        rc = apply_targets_locked(mask);
     }
-    if (!rc)
-        rc = apply_targets_locked();
     mutex_unlock(&g_lock);
+out:
+    kfree(txn);
     kfree(kbuf);
     if (rc)
         return rc;
@@ -350,18 +496,20 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t coun
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0))
 static const struct proc_ops proc_fops = {
-    .proc_read  = proc_read,
-    .proc_write = proc_write,
+    .proc_open    = proc_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+    .proc_write   = proc_write,
 };
 #else
-static ssize_t legacy_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
-{ return proc_read(file, buf, count, ppos); }
-static ssize_t legacy_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
-{ return proc_write(file, buf, count, ppos); }
 static const struct file_operations proc_fops = {
-    .owner = THIS_MODULE,
-    .read  = legacy_read,
-    .write = legacy_write,
+    .owner   = THIS_MODULE,
+    .open    = proc_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+    .write   = proc_write,
 };
 #endif
 
@@ -389,7 +537,7 @@ static void monitor_timer_callback(struct timer_list *t)
             if (verbose)
                 pr_info("chg_param_override: pd_verifed reset detected (%d->%d), reapplying settings\n",
                         g_targets.pd_verifed, current_pd_verifed);
-            apply_targets_locked();
+            apply_targets_locked(CHG_APPLY_ALL);
         }
         mutex_unlock(&g_lock);
     }
@@ -445,7 +593,7 @@ static int show_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
     }
 
     mutex_lock(&g_lock);
-    if (name && !strcmp(name, target_batt)) {
+    if (name && name_in_list(name, target_batt)) {
         if (!strcmp(attr, "voltage_max") && g_targets.voltage_max_uv > 0) {
             v = scnprintf(args->buf, PAGE_SIZE, "%d\n", g_targets.voltage_max_uv);
 #if defined(CONFIG_ARM64)
@@ -463,7 +611,7 @@ static int show_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
             regs->regs[0] = (unsigned long)v;
 #endif
         }
-    } else if (name && !strcmp(name, target_usb)) {
+    } else if (name && name_in_list(name, target_usb)) {
         if (!strcmp(attr, "input_current_limit") && g_targets.usb_input_current_limit_ua > 0) {
             v = scnprintf(args->buf, PAGE_SIZE, "%d\n", g_targets.usb_input_current_limit_ua);
 #if defined(CONFIG_ARM64)
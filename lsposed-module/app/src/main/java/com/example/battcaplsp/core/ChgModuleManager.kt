@@ -59,8 +59,12 @@ class ChgModuleManager(
         )
     }
 
-    /** Batch write k=v lines to /proc/chg_param_override. Empty values are skipped. */
-    suspend fun applyBatch(params: Map<String, String?>): RootShell.ExecResult = withContext(Dispatchers.IO) {
+    /**
+     * Batch write k=v lines to /proc/chg_param_override. Empty values are skipped.
+     * 内核按整批校验后原子提交；传入 [expectedGen]（readCurrent 的 gen）时，
+     * 若期间配置被其它写入者（如开机脚本）修改，写入以 EAGAIN 失败且不生效。
+     */
+    suspend fun applyBatch(params: Map<String, String?>, expectedGen: Long? = null): RootShell.ExecResult = withContext(Dispatchers.IO) {
         fun sanitize(raw: String): String = raw
             .replace("\r", " ")
             .replace("\n", " ")          // 真换行
@@ -78,9 +82,10 @@ class ChgModuleManager(
         if (cleaned.isEmpty()) return@withContext RootShell.exec(":")
 
         val builder = buildString {
+            if (expectedGen != null) append("gen=").append(expectedGen).append('\n')
             cleaned.forEach { (k,v) -> append(k).append('=').append(v).append('\n') }
         }
-        // 确保末尾有换行，便于内核逐行解析
+        // 确保末尾有换行，便于内核逐行解析（整批一次 write，内核据此做事务提交）
         val payload = if (builder.endsWith("\n")) builder else builder + "\n"
         RootShell.exec("printf %s "+RootShell.shellArg(payload)+" | tee "+procPath)
     }
@@ -235,7 +240,7 @@ class ChgModuleManager(
 
     /** Read current values from /proc/chg_param_override and return as a map. */
     suspend fun readCurrent(): Map<String, String> = withContext(Dispatchers.IO) {
-        if (!isLoaded()) return@withContext emptyMap()
+        // 未加载时 proc 节点不存在、输出为空，无需先单独探测（省一次 root 往返）
         val r = RootShell.exec("cat "+procPath+" 2>/dev/null || true")
         if (r.code != 0 || r.out.isBlank()) return@withContext emptyMap()
         val map = mutableMapOf<String, String>()
@@ -255,7 +260,7 @@ class ChgModuleManager(
                 val k = ln.substring(0, idx)
                 var v = ln.substring(idx + 1)
                 // 如果值里仍然混入其它行（异常情况），截断到第一个换行或出现第二个 key 样式片段前
-                val secondKeyMatch = Regex("\\b(voltage_max|ccc|term|icl|charge_limit|auto_reapply)=").find(v)
+                val secondKeyMatch = Regex("\\b(version|gen|voltage_max|ccc|term|icl|charge_limit|pd_verifed|pd_verifed_enabled|auto_reapply)=").find(v)
                 if (secondKeyMatch != null) {
                     v = v.substring(0, secondKeyMatch.range.first).trim()
                 }
@@ -266,6 +271,10 @@ class ChgModuleManager(
         return@withContext map
     }
 
+    /** 写入因 gen 不匹配被内核拒绝（EAGAIN） */
+    fun isStaleGeneration(r: RootShell.ExecResult): Boolean =
+        r.code != 0 && (r.err.contains("Try again", ignoreCase = true) || r.err.contains("EAGAIN"))
+
     private fun shellQuoteIfNeeded(s: String): String {
         return if (s.matches(Regex("^[A-Za-z0-9._/:=-]+$"))) s else RootShell.shellArg(s)
     }
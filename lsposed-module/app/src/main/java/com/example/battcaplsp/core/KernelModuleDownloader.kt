@@ -2,19 +2,29 @@ package com.override.battcaplsp.core
 
 import android.content.Context
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.withContext
 import java.io.File
 import java.io.FileOutputStream
-import java.io.InputStream
+import java.io.IOException
 import java.net.HttpURLConnection
 import java.net.URL
 import java.security.MessageDigest
+import java.util.concurrent.ConcurrentHashMap
+import kotlin.random.Random
 
 /**
  * 内核模块下载管理器
  * 负责根据内核版本自动下载对应的 .ko 文件
+ *
+ * 下载结果进入内容寻址缓存 [KoCache]：带 ETag/Last-Modified 重新验证，304 时直接复用；
+ * 中断的下载保留 .part 并以 HTTP Range 续传；SHA256 在写盘的同时计算，不再二次读文件。
+ * [apiBase] 可指向本地 HTTP 替身服务器用于测试。
  */
-class KernelModuleDownloader(private val context: Context) {
+class KernelModuleDownloader(
+    private val context: Context,
+    private val apiBase: String = GITHUB_API_BASE
+) {
     
     companion object {
         // GitHub Releases API 基础 URL
@@ -35,8 +45,24 @@ class KernelModuleDownloader(private val context: Context) {
             "batt_design_override",
             "chg_param_override"
         )
+
+        private const val USER_AGENT = "battcaplsp-app/1.0 (+https://github.com/serein-213)"
+        private const val MAX_DOWNLOAD_ATTEMPTS = 4
+
+        /** 同一 URL 共享 .part 与清单条目，下载需串行（跨实例） */
+        private val urlLocks = ConcurrentHashMap<String, Any>()
+    }
+
+    private val cache by lazy { KoCache(File(getModuleStorageDir(), ".cache")) }
+
+    /** 指数退避 + 抖动：500ms, 1s, 2s ... */
+    private suspend fun backoff(attempt: Int) {
+        delay((500L shl attempt.coerceAtMost(4)) + Random.nextLong(250L))
     }
 
+    private fun currentKernelRelease(): String =
+        runCatching { File("/proc/sys/kernel/osrelease").readText().trim() }.getOrNull().orEmpty().ifEmpty { "unknown" }
+
     /**
      * 判断资产名是否匹配指定模块/内核主次版本，允许：
      * - 带或不带 android 段（如 android13- 可选）
@@ -103,20 +129,35 @@ class KernelModuleDownloader(private val context: Context) {
         
         repeat(maxRetries) { attempt ->
             try {
-                val url = URL("$GITHUB_API_BASE/releases")  // 获取所有releases而不仅仅是latest
+                val url = URL("$apiBase/releases")  // 获取所有releases而不仅仅是latest
                 val connection = url.openConnection() as HttpURLConnection
                 connection.connectTimeout = 12000
                 connection.readTimeout = 15000
                 connection.setRequestProperty("Accept", "application/vnd.github.v3+json")
                 connection.setRequestProperty("User-Agent", ua)
+                // 携带上次的 ETag：未变化时 GitHub 返回 304 且不计入限流
+                val cachedBody = releasesCacheFile.takeIf { it.isFile }?.readText()
+                val cachedEtag = releasesEtagFile.takeIf { it.isFile }?.readText()?.trim()
+                if (cachedBody != null && !cachedEtag.isNullOrEmpty()) {
+                    connection.setRequestProperty("If-None-Match", cachedEtag)
+                }
                 
                 val code = connection.responseCode
-                if (code != HttpURLConnection.HTTP_OK) {
+                if (code != HttpURLConnection.HTTP_OK && !(code == HttpURLConnection.HTTP_NOT_MODIFIED && cachedBody != null)) {
                     lastError = RuntimeException("HTTP $code")
                     android.util.Log.w("KernelModuleDownloader", "HTTP $code on attempt ${attempt + 1}")
                 } else {
-                    val response = connection.inputStream.bufferedReader().readText()
-                    android.util.Log.d("KernelModuleDownloader", "Response length: ${response.length}")
+                    val response = if (code == HttpURLConnection.HTTP_NOT_MODIFIED) cachedBody!! else {
+                        connection.inputStream.bufferedReader().readText().also { body ->
+                            runCatching {
+                                // .cache 目录通常由 KoCache 懒加载创建，此时可能尚不存在
+                                releasesCacheFile.parentFile?.mkdirs()
+                                releasesCacheFile.writeText(body)
+                                releasesEtagFile.writeText(connection.getHeaderField("ETag").orEmpty())
+                            }
+                        }
+                    }
+                    android.util.Log.d("KernelModuleDownloader", "Response length: ${response.length} (HTTP $code)")
                     
                     // 解析所有releases
                     val releases = parseAllGitHubReleases(response)
@@ -134,8 +175,7 @@ class KernelModuleDownloader(private val context: Context) {
                 lastError = e
                 android.util.Log.e("KernelModuleDownloader", "Attempt ${attempt + 1} failed", e)
             }
-            // 简单退避
-            try { Thread.sleep((800L * (attempt + 1))) } catch (_: Throwable) {}
+            if (attempt < maxRetries - 1) backoff(attempt)
         }
         
         android.util.Log.e("KernelModuleDownloader", "All attempts failed", lastError)
@@ -149,7 +189,7 @@ class KernelModuleDownloader(private val context: Context) {
         var lastError: Exception? = null
         repeat(maxRetries) { attempt ->
             try {
-                val url = URL("$GITHUB_API_BASE/releases/latest")
+                val url = URL("$apiBase/releases/latest")
                 val connection = url.openConnection() as HttpURLConnection
                 connection.connectTimeout = 12000
                 connection.readTimeout = 15000
@@ -188,8 +228,7 @@ class KernelModuleDownloader(private val context: Context) {
                 lastError = e
                 android.util.Log.e("KernelModuleDownloader", "Attempt ${attempt + 1} failed", e)
             }
-            // 简单退避
-            try { Thread.sleep((800L * (attempt + 1))) } catch (_: Throwable) {}
+            if (attempt < maxRetries - 1) backoff(attempt)
         }
         android.util.Log.e("KernelModuleDownloader", "All attempts failed", lastError)
         null
@@ -229,6 +268,7 @@ class KernelModuleDownloader(private val context: Context) {
                 val assetNames = assetNamePattern.findAll(releaseSection).map { it.groupValues[1] }.toList()
                 val downloadUrls = downloadUrlPattern.findAll(releaseSection).map { it.groupValues[1] }.toList()
                 val sizes = sizePattern.findAll(releaseSection).map { it.groupValues[1].toLongOrNull() ?: 0L }.toList()
+                val digests = parseAssetDigests(releaseSection)
                 
                 // 匹配 .ko 文件的 assets
                 for (j in assetNames.indices) {
@@ -236,7 +276,7 @@ class KernelModuleDownloader(private val context: Context) {
                     if (assetName.endsWith(".ko") && j < downloadUrls.size) {
                         val downloadUrl = downloadUrls.find { url -> url.contains(assetName) } ?: continue
                         val size = if (j < sizes.size) sizes[j] else 0L
-                        assets.add(GitHubAsset(assetName, downloadUrl, size))
+                        assets.add(GitHubAsset(assetName, downloadUrl, size, digests[downloadUrl]))
                     }
                 }
                 
@@ -272,6 +312,7 @@ class KernelModuleDownloader(private val context: Context) {
             val assetNames = Regex("\"name\"\\s*:\\s*\"([^\"]+)\"").findAll(jsonResponse).map { it.groupValues[1] }.toList()
             val downloadUrls = Regex("\"browser_download_url\"\\s*:\\s*\"([^\"]+)\"").findAll(jsonResponse).map { it.groupValues[1] }.toList()
             val sizes = Regex("\"size\"\\s*:\\s*(\\d+)").findAll(jsonResponse).map { it.groupValues[1].toLongOrNull() ?: 0L }.toList()
+            val digests = parseAssetDigests(jsonResponse)
             
             android.util.Log.d("KernelModuleDownloader", "Found ${assetNames.size} names, ${downloadUrls.size} urls, ${sizes.size} sizes")
             
@@ -283,7 +324,7 @@ class KernelModuleDownloader(private val context: Context) {
                 val size = if (i < sizes.size) sizes[i] else 0L
                 
                 android.util.Log.d("KernelModuleDownloader", "Asset: $assetName -> $downloadUrl")
-                assets.add(GitHubAsset(assetName, downloadUrl, size))
+                assets.add(GitHubAsset(assetName, downloadUrl, size, digests[downloadUrl]))
             }
             
             android.util.Log.d("KernelModuleDownloader", "Parsed ${assets.size} assets")
@@ -294,6 +335,28 @@ class KernelModuleDownloader(private val context: Context) {
         }
     }
     
+    /**
+     * 解析资产的 "digest": "sha256:<hex>"，返回 browser_download_url -> sha256。
+     * GitHub 资产对象中 digest 位于同一资产的 browser_download_url 之前，
+     * 因此取两个下载地址之间最后出现的 digest；旧资产可能没有该字段（或为 null），此时不校验。
+     */
+    private fun parseAssetDigests(json: String): Map<String, String> {
+        val urlPattern = Regex("\"browser_download_url\"\\s*:\\s*\"([^\"]+)\"")
+        val digestPattern = Regex("\"digest\"\\s*:\\s*\"sha256:([0-9a-fA-F]{64})\"")
+        val result = mutableMapOf<String, String>()
+        var from = 0
+        for (m in urlPattern.findAll(json)) {
+            digestPattern.findAll(json.substring(from, m.range.first)).lastOrNull()?.let {
+                result[m.groupValues[1]] = it.groupValues[1].lowercase()
+            }
+            from = m.range.last + 1
+        }
+        return result
+    }
+
+    private val releasesCacheFile get() = File(getModuleStorageDir(), ".cache/releases.json")
+    private val releasesEtagFile get() = File(getModuleStorageDir(), ".cache/releases.etag")
+
     /** 获取内核模块存储目录 */
     private fun getModuleStorageDir(): File {
         val dir = File(context.filesDir, "kernel_modules")
@@ -427,93 +490,215 @@ class KernelModuleDownloader(private val context: Context) {
             ?.first
     }
     
-    /** 下载指定模块 */
-    suspend fun downloadModule(moduleInfo: ModuleInfo, onProgress: ((Int) -> Unit)? = null): DownloadResult = withContext(Dispatchers.IO) {
+    /** 下载指定模块（经内容寻址缓存，未变化的资产不会重复下载或哈希） */
+    suspend fun downloadModule(moduleInfo: ModuleInfo, onProgress: ((Int) -> Unit)? = null): DownloadResult =
+        downloadModule(moduleInfo, force = false, onProgress = onProgress)
+
+    private suspend fun downloadModule(
+        moduleInfo: ModuleInfo,
+        force: Boolean,
+        onProgress: ((Int) -> Unit)?
+    ): DownloadResult = withContext(Dispatchers.IO) {
+        val url = moduleInfo.downloadUrl
+        val expectedSha = moduleInfo.sha256?.lowercase()
+        try {
+            // 发布方给出的哈希与缓存一致：无需联网
+            val entry = cache.asset(url)
+            val cached = cache.cachedObject(entry)
+            if (!force && cached != null && expectedSha != null && expectedSha == entry?.sha256) {
+                onProgress?.invoke(100)
+                return@withContext materialize(moduleInfo, cached, expectedSha, fromCache = true)
+            }
+
+            var lastError: Exception? = null
+            for (attempt in 0 until MAX_DOWNLOAD_ATTEMPTS) {
+                try {
+                    val (obj, fromCache) = fetchToCache(url, expectedSha, force, onProgress)
+                    val sha = cache.asset(url)?.sha256 ?: obj.nameWithoutExtension
+                    return@withContext materialize(moduleInfo, obj, sha, fromCache)
+                } catch (e: ShaMismatchException) {
+                    return@withContext DownloadResult(success = false, message = "文件校验失败: SHA256 不匹配")
+                } catch (e: HttpStatusException) {
+                    // 4xx 基本不可恢复（416 除外：已清理 .part，下一轮从头下载）
+                    if (e.code in 400..499 && e.code != 416) {
+                        return@withContext DownloadResult(success = false, message = "下载失败: HTTP ${e.code}")
+                    }
+                    lastError = e
+                } catch (e: IOException) {
+                    // 网络中断：.part 保留，下一轮以 Range 续传
+                    lastError = e
+                }
+                android.util.Log.w("KernelModuleDownloader", "Download attempt ${attempt + 1} failed: ${lastError?.message}")
+                if (attempt < MAX_DOWNLOAD_ATTEMPTS - 1) backoff(attempt)
+            }
+            DownloadResult(success = false, message = "下载异常: ${lastError?.message}")
+        } catch (e: Exception) {
+            DownloadResult(
+                success = false,
+                message = "下载异常: ${e.message}"
+            )
+        }
+    }
+
+    private class HttpStatusException(val code: Int) : IOException("HTTP $code")
+    private class ShaMismatchException : IOException("SHA256 mismatch")
+
+    /**
+     * 将资产取入缓存，返回 (缓存对象, 是否命中缓存)。
+     * - 已有缓存：带 If-None-Match / If-Modified-Since 重新验证，304 直接返回
+     * - 有未完成的 .part：带 Range + If-Range 续传，206 追加，200 表示资源已变化、从头下载
+     * 哈希在写盘同时计算；仅续传时需读一次已有前缀。
+     * 同一 URL 的并发调用按 URL 加锁串行，后到者会直接重新验证先到者写入的缓存。
+     */
+    private fun fetchToCache(
+        url: String,
+        expectedSha: String?,
+        force: Boolean,
+        onProgress: ((Int) -> Unit)?
+    ): Pair<File, Boolean> = synchronized(urlLocks.computeIfAbsent(url) { Any() }) {
+        fetchToCacheLocked(url, expectedSha, force, onProgress)
+    }
+
+    private fun fetchToCacheLocked(
+        url: String,
+        expectedSha: String?,
+        force: Boolean,
+        onProgress: ((Int) -> Unit)?
+    ): Pair<File, Boolean> {
+        val entry = cache.asset(url)
+        // 发布方哈希与缓存不符时缓存视为无效：不发条件请求，完整下载并校验，避免 304 装上旧对象
+        val stale = expectedSha != null && entry?.sha256 != expectedSha
+        val cached = if (force || stale) null else cache.cachedObject(entry)
+        val part = cache.partFile(url)
+        val partialEtag = entry?.partialEtag
+        val canResume = cached == null && part.length() > 0 && partialEtag != null
+
+        val connection = URL(url).openConnection() as HttpURLConnection
         try {
-            val url = URL(moduleInfo.downloadUrl)
-            val connection = url.openConnection() as HttpURLConnection
             connection.connectTimeout = 30000
             connection.readTimeout = 60000
-            connection.setRequestProperty("User-Agent", "battcaplsp-app/1.0 (+https://github.com/serein-213)")
-            
-            if (connection.responseCode != HttpURLConnection.HTTP_OK) {
-                return@withContext DownloadResult(
-                    success = false,
-                    message = "下载失败: HTTP ${connection.responseCode}"
-                )
+            connection.setRequestProperty("User-Agent", USER_AGENT)
+            if (cached != null) {
+                entry?.etag?.let { connection.setRequestProperty("If-None-Match", it) }
+                entry?.lastModified?.let { connection.setRequestProperty("If-Modified-Since", it) }
+            } else if (canResume) {
+                connection.setRequestProperty("Range", "bytes=${part.length()}-")
+                connection.setRequestProperty("If-Range", partialEtag)
             }
-            
-            val contentLength = connection.contentLengthLong
-            val storageDir = getModuleStorageDir()
-            
-            // 使用与 GitHub 文件名相同的命名格式
-            val originalFileName = moduleInfo.downloadUrl.substringAfterLast("/")
-            val localFile = File(storageDir, originalFileName)
-            // 覆盖策略: 若已存在同名文件先删除，确保重新下载（符合“不要使用本地缓存”需求）
-            if (localFile.exists()) {
-                runCatching { localFile.delete() }
+
+            val code = connection.responseCode
+            if (code == HttpURLConnection.HTTP_NOT_MODIFIED && cached != null) {
+                android.util.Log.d("KernelModuleDownloader", "Not modified, using cached ${cached.name}")
+                onProgress?.invoke(100)
+                return cached to true
             }
-            
+            if (code == 416) {
+                part.delete()
+                cache.putAsset(url, (entry ?: KoCache.AssetEntry()).copy(partialEtag = null))
+            }
+            if (code != HttpURLConnection.HTTP_OK && code != HttpURLConnection.HTTP_PARTIAL) {
+                throw HttpStatusException(code)
+            }
+
+            // 206 必须从 .part 末尾续接，否则丢弃 .part，下一轮完整下载
+            if (code == HttpURLConnection.HTTP_PARTIAL) {
+                val start = Regex("^bytes\\s+(\\d+)-").find(connection.getHeaderField("Content-Range").orEmpty())
+                    ?.groupValues?.get(1)?.toLongOrNull()
+                val have = part.length()
+                if (!canResume || start != have) {
+                    part.delete()
+                    cache.putAsset(url, (entry ?: KoCache.AssetEntry()).copy(partialEtag = null))
+                    throw IOException("unexpected Content-Range (start=$start, have=$have)")
+                }
+            }
+            val resume = code == HttpURLConnection.HTTP_PARTIAL
+            val digest = MessageDigest.getInstance("SHA-256")
+            var done = 0L
+            if (resume) {
+                done = digestInto(part, digest)
+            } else {
+                part.delete()
+            }
+            val etag = connection.getHeaderField("ETag")
+            val lastModified = connection.getHeaderField("Last-Modified")
+            // 先记下 ETag，进程被杀后仍可续传
+            cache.putAsset(url, (entry ?: KoCache.AssetEntry()).copy(partialEtag = etag))
+
+            val remaining = connection.contentLengthLong
+            val total = if (remaining > 0) done + remaining else -1L
             connection.inputStream.use { input ->
-                FileOutputStream(localFile).use { output ->
-                    val buffer = ByteArray(8192)
-                    var totalBytesRead = 0L
-                    var bytesRead: Int
-                    
-                    while (input.read(buffer).also { bytesRead = it } != -1) {
-                        output.write(buffer, 0, bytesRead)
-                        totalBytesRead += bytesRead
-                        
-                        if (contentLength > 0) {
-                            val progress = (totalBytesRead * 100 / contentLength).toInt()
-                            onProgress?.invoke(progress)
+                FileOutputStream(part, resume).use { output ->
+                    val buffer = ByteArray(64 * 1024)
+                    var lastProgress = -1
+                    while (true) {
+                        val n = input.read(buffer)
+                        if (n < 0) break
+                        output.write(buffer, 0, n)
+                        digest.update(buffer, 0, n)
+                        done += n
+                        if (total > 0) {
+                            val progress = (done * 100 / total).toInt()
+                            if (progress != lastProgress) {
+                                lastProgress = progress
+                                onProgress?.invoke(progress)
+                            }
                         }
                     }
+                    output.fd.sync()
                 }
             }
-            
-            // 验证文件完整性（如果提供了 SHA256）
-            if (moduleInfo.sha256 != null) {
-                val actualSha256 = calculateSHA256(localFile)
-                if (actualSha256 != moduleInfo.sha256) {
-                    localFile.delete()
-                    return@withContext DownloadResult(
-                        success = false,
-                        message = "文件校验失败: SHA256 不匹配"
-                    )
-                }
+            if (total > 0 && done != total) throw IOException("incomplete: $done/$total")
+
+            val sha = KoCache.hex(digest.digest())
+            if (expectedSha != null && expectedSha != sha) {
+                part.delete()
+                cache.putAsset(url, (entry ?: KoCache.AssetEntry()).copy(partialEtag = null))
+                throw ShaMismatchException()
             }
-            
-            DownloadResult(
-                success = true,
-                message = "下载成功",
-                localPath = localFile.absolutePath,
-                fileSize = localFile.length()
-            )
-            
-        } catch (e: Exception) {
-            DownloadResult(
-                success = false,
-                message = "下载异常: ${e.message}"
-            )
+            val obj = cache.commit(part, sha)
+            cache.putAsset(url, KoCache.AssetEntry(etag, lastModified, sha, obj.length()))
+            return obj to false
+        } finally {
+            connection.disconnect()
         }
     }
 
-    /** 强制下载（语义化包装，便于调用方表达 intent），内部直接调用 downloadModule */
+    /** 将缓存对象链接（失败则复制）为存储目录下的原始文件名，并记录当前内核的安装绑定 */
+    private fun materialize(moduleInfo: ModuleInfo, obj: File, sha256: String, fromCache: Boolean): DownloadResult {
+        val originalFileName = moduleInfo.downloadUrl.substringAfterLast("/")
+        val localFile = File(getModuleStorageDir(), originalFileName)
+        if (localFile.exists()) {
+            runCatching { localFile.delete() }
+        }
+        val linked = runCatching { android.system.Os.link(obj.absolutePath, localFile.absolutePath) }.isSuccess
+        if (!linked) {
+            obj.copyTo(localFile, overwrite = true)
+        }
+        cache.bind(currentKernelRelease(), moduleInfo.name, sha256, moduleInfo.version, localFile.absolutePath)
+        return DownloadResult(
+            success = true,
+            message = if (fromCache) "下载成功（本地缓存未变化）" else "下载成功",
+            localPath = localFile.absolutePath,
+            fileSize = localFile.length()
+        )
+    }
+
+    /** 强制下载（语义化包装，便于调用方表达 intent）：跳过缓存重新验证，仍写入缓存 */
     suspend fun forceRedownload(moduleInfo: ModuleInfo, onProgress: ((Int) -> Unit)? = null): DownloadResult =
-        downloadModule(moduleInfo, onProgress)
+        downloadModule(moduleInfo, force = true, onProgress = onProgress)
     
-    /** 计算文件 SHA256 */
-    private fun calculateSHA256(file: File): String {
-        val digest = MessageDigest.getInstance("SHA-256")
+    /** 将文件内容送入 digest，返回字节数（仅用于续传时补算已下载前缀） */
+    private fun digestInto(file: File, digest: MessageDigest): Long {
+        var total = 0L
         file.inputStream().use { fis ->
-            val buffer = ByteArray(8192)
+            val buffer = ByteArray(64 * 1024)
             var bytesRead: Int
             while (fis.read(buffer).also { bytesRead = it } != -1) {
                 digest.update(buffer, 0, bytesRead)
+                total += bytesRead
             }
         }
-        return digest.digest().joinToString("") { "%02x".format(it) }
+        return total
     }
     
     /** 检查本地是否已有对应版本的模块（按精确匹配优先级排序） */
@@ -527,6 +712,12 @@ class KernelModuleDownloader(private val context: Context) {
             kernelVersion
         }
         
+        // 当前内核已安装过同一 release 的缓存对象优先（切换内核线后再切回无需重新下载）
+        cache.bound(currentKernel, moduleName, version)?.let {
+            android.util.Log.d("KernelModuleDownloader", "Found cached module for $currentKernel: ${it.name}")
+            return it
+        }
+
         val majorMinor = currentKernel.split('.').take(2).joinToString(".")
         val androidVersion = KERNEL_TO_ANDROID[majorMinor]
         
@@ -592,5 +783,6 @@ class KernelModuleDownloader(private val context: Context) {
                     .forEach { it.delete() }
             }
         }
+        cache.gc()
     }
 }
@@ -0,0 +1,167 @@
+package com.override.battcaplsp.core
+
+import org.json.JSONObject
+import java.io.File
+import java.security.MessageDigest
+
+/**
+ * 内容寻址的 .ko 本地缓存
+ * - objects/<sha256>.ko：按内容哈希存放，不同 release / 内核线中内容相同的模块只存一份
+ * - objects/<url哈希>.part：未完成的下载，配合 HTTP Range 续传
+ * - manifest.json：资产 URL -> ETag / Last-Modified / sha256 / size，
+ *   以及 "<内核 release>/<模块名>" -> (sha256, release 版本) 的安装绑定
+ * 清单中记录的 sha256 即对象文件名，命中时无需再次读取文件计算哈希。
+ */
+class KoCache(private val root: File) {
+
+    data class AssetEntry(
+        val etag: String? = null,
+        val lastModified: String? = null,
+        val sha256: String? = null,
+        val size: Long = 0L,
+        /** 未完成下载对应的 ETag，续传时用作 If-Range */
+        val partialEtag: String? = null
+    )
+
+    data class Binding(
+        val sha256: String,
+        /** 安装时的 release tag；旧清单中没有此字段 */
+        val version: String? = null,
+        /** materialize 出的存储目录文件（与对象共享 inode） */
+        val path: String? = null
+    )
+
+    private val objectsDir = File(root, "objects")
+    private val manifestFile = File(root, "manifest.json")
+    private val assets = mutableMapOf<String, AssetEntry>()
+    private val bindings = mutableMapOf<String, Binding>()
+
+    init {
+        objectsDir.mkdirs()
+        load()
+    }
+
+    @Synchronized
+    fun asset(url: String): AssetEntry? = assets[url]
+
+    @Synchronized
+    fun putAsset(url: String, entry: AssetEntry) {
+        assets[url] = entry
+        save()
+    }
+
+    @Synchronized
+    fun bind(kernelRelease: String, moduleName: String, sha256: String, version: String, path: String) {
+        bindings["$kernelRelease/$moduleName"] = Binding(sha256, version, path)
+        save()
+    }
+
+    /** 当前内核 release 下该模块最近一次安装的缓存对象；仅当安装的就是所请求的 release 时返回 */
+    @Synchronized
+    fun bound(kernelRelease: String, moduleName: String, version: String): File? =
+        bindings["$kernelRelease/$moduleName"]?.takeIf { it.version == version }
+            ?.let { objectFile(it.sha256) }?.takeIf { it.isFile && it.length() > 0 }
+
+    fun objectFile(sha256: String): File = File(objectsDir, "${sha256.lowercase()}.ko")
+
+    fun partFile(url: String): File = File(objectsDir, hex(MessageDigest.getInstance("SHA-256").digest(url.toByteArray())) + ".part")
+
+    /** 清单条目对应的有效缓存对象：文件存在且大小与清单一致 */
+    fun cachedObject(entry: AssetEntry?): File? {
+        val sha = entry?.sha256 ?: return null
+        return objectFile(sha).takeIf { it.isFile && it.length() == entry.size }
+    }
+
+    /** 将已校验的下载结果原子地移入对象区 */
+    fun commit(part: File, sha256: String): File {
+        val obj = objectFile(sha256)
+        if (obj.isFile && obj.length() == part.length()) {
+            part.delete()
+        } else if (!part.renameTo(obj)) {
+            part.copyTo(obj, overwrite = true)
+            part.delete()
+        }
+        return obj
+    }
+
+    /**
+     * 回收空间：先丢弃 materialize 文件已被删除（或无记录）的绑定，再丢弃不再被任何绑定引用的
+     * 已完成资产条目，最后删除未被引用的对象及孤立的 .part。
+     * 存储目录里的 .ko 与对象是硬链接，只删前者不会释放空间，需在清理后调用本方法。
+     */
+    @Synchronized
+    fun gc() {
+        bindings.values.removeAll { b -> b.path == null || !File(b.path).isFile }
+        val boundShas = bindings.values.map { it.sha256.lowercase() }.toSet()
+        assets.values.removeAll { e -> e.partialEtag == null && e.sha256?.lowercase() !in boundShas }
+        save()
+        val live = (assets.values.mapNotNull { it.sha256 } + bindings.values.map { it.sha256 }).map { "${it.lowercase()}.ko" }.toSet()
+        val liveParts = assets.filterValues { it.partialEtag != null }.keys.map { partFile(it).name }.toSet()
+        objectsDir.listFiles()?.forEach { f ->
+            val keep = if (f.name.endsWith(".part")) f.name in liveParts else f.name in live
+            if (!keep) f.delete()
+        }
+    }
+
+    private fun load() {
+        val json = runCatching { JSONObject(manifestFile.readText()) }.getOrNull() ?: return
+        json.optJSONObject("assets")?.let { a ->
+            a.keys().forEach { url ->
+                val o = a.getJSONObject(url)
+                assets[url] = AssetEntry(
+                    etag = o.optString("etag").ifEmpty { null },
+                    lastModified = o.optString("lastModified").ifEmpty { null },
+                    sha256 = o.optString("sha256").ifEmpty { null },
+                    size = o.optLong("size", 0L),
+                    partialEtag = o.optString("partialEtag").ifEmpty { null }
+                )
+            }
+        }
+        json.optJSONObject("bindings")?.let { b ->
+            b.keys().forEach { k ->
+                // 版本 1 的绑定只有 sha256 字符串
+                val o = b.optJSONObject(k)
+                bindings[k] = if (o != null) {
+                    Binding(
+                        o.getString("sha256"),
+                        o.optString("version").ifEmpty { null },
+                        o.optString("path").ifEmpty { null }
+                    )
+                } else {
+                    Binding(b.getString(k))
+                }
+            }
+        }
+    }
+
+    private fun save() {
+        val a = JSONObject()
+        assets.forEach { (url, e) ->
+            a.put(url, JSONObject().apply {
+                e.etag?.let { put("etag", it) }
+                e.lastModified?.let { put("lastModified", it) }
+                e.sha256?.let { put("sha256", it) }
+                put("size", e.size)
+                e.partialEtag?.let { put("partialEtag", it) }
+            })
+        }
+        val b = JSONObject()
+        bindings.forEach { (k, v) ->
+            b.put(k, JSONObject().apply {
+                put("sha256", v.sha256)
+                v.version?.let { put("version", it) }
+                v.path?.let { put("path", it) }
+            })
+        }
+        val tmp = File(root, "manifest.json.tmp")
+        tmp.writeText(JSONObject().put("version", 2).put("assets", a).put("bindings", b).toString())
+        if (!tmp.renameTo(manifestFile)) {
+            tmp.copyTo(manifestFile, overwrite = true)
+            tmp.delete()
+        }
+    }
+
+    companion object {
+        fun hex(bytes: ByteArray): String = bytes.joinToString("") { "%02x".format(it) }
+    }
+}
@@ -295,6 +295,9 @@ class MagiskModuleManager(private val context: Context) {
             [ -n "${'$'}DESIGN_UWH" ] && ARGS="${'$'}ARGS design_uwh=${'$'}DESIGN_UWH"
             [ -n "${'$'}BATT_NAME" ] && ARGS="${'$'}ARGS batt_name=${'$'}BATT_NAME"
             [ -n "${'$'}OVERRIDE_ANY" ] && ARGS="${'$'}ARGS override_any=${'$'}OVERRIDE_ANY"
+            [ -n "${'$'}OVERRIDES" ] && ARGS="${'$'}ARGS overrides=${'$'}OVERRIDES"
+            [ -n "${'$'}CACHE_ENABLE" ] && ARGS="${'$'}ARGS cache_enable=${'$'}CACHE_ENABLE"
+            [ -n "${'$'}CACHE_TTL" ] && ARGS="${'$'}ARGS cache_ttl=${'$'}CACHE_TTL"
             [ -n "${'$'}VERBOSE" ] && ARGS="${'$'}ARGS verbose=${'$'}VERBOSE"
             
             ARGS=${'$'}(echo "${'$'}ARGS" | sed 's/^ *//')
@@ -68,28 +68,20 @@ class ModuleManager(
         android.util.Log.d("ModuleManager", "Possible file names: $possibleFileNames")
         android.util.Log.d("ModuleManager", "Search paths: $searchPaths")
         
-        // 在所有搜索路径中查找文件
-        for (searchPath in searchPaths) {
-            android.util.Log.d("ModuleManager", "Searching in path: $searchPath")
-            
-            for (fileName in possibleFileNames) {
-                val filePath = "$searchPath/$fileName"
-                
-                try {
-                    // 使用 root shell 检查文件是否存在且不为空
-                    val checkResult = RootShell.exec("[ -f '$filePath' ] && [ -s '$filePath' ] && echo 'found' || echo 'not_found'")
-                    
-                    android.util.Log.d("ModuleManager", "Checking $filePath: result=${checkResult.out.trim()}")
-                    
-                    if (checkResult.code == 0 && checkResult.out.trim() == "found") {
-                        android.util.Log.d("ModuleManager", "Found module file: $filePath")
-                        return@withContext filePath
-                    }
-                } catch (e: Exception) {
-                    android.util.Log.w("ModuleManager", "Error checking file $filePath", e)
-                    continue
-                }
+        // 在所有搜索路径中查找文件：整个候选列表在一次 root 往返内按优先级检查
+        val candidates = searchPaths.flatMap { path -> possibleFileNames.map { "$path/$it" } }
+        val script = "for f in " + candidates.joinToString(" ") { shellQuote(it) } +
+            "; do [ -f \"\$f\" ] && [ -s \"\$f\" ] && { echo \"\$f\"; break; }; done"
+        try {
+            val checkResult = RootShell.exec(script)
+            val found = checkResult.out.lineSequence().map { it.trim() }.firstOrNull { it in candidates }
+            android.util.Log.d("ModuleManager", "Checked ${candidates.size} candidates: result=${found ?: "none"}")
+            if (found != null) {
+                android.util.Log.d("ModuleManager", "Found module file: $found")
+                return@withContext found
             }
+        } catch (e: Exception) {
+            android.util.Log.w("ModuleManager", "Error checking module candidates", e)
         }
         
         android.util.Log.w("ModuleManager", "No suitable module file found for $moduleName")
@@ -216,25 +208,19 @@ class ModuleManager(
             val initStatePath = "$sysModuleBase/$moduleName/initstate"
             val initState = runCatching { File(initStatePath).takeIf { it.exists() }?.readText()?.trim() }.getOrNull()
             if (initState == "live") return@withContext true
-            // 使用 root 兜底读取（避免权限问题）
-            val initStateRes = RootShell.exec("cat ${shellQuoteIfNeeded(initStatePath)} 2>/dev/null || true")
-            if (initStateRes.code == 0 && initStateRes.out.trim() == "live") return@withContext true
         } catch (_: Throwable) {
             // ignore and fallback
         }
 
-        // 次级检查：/proc/modules 存在条目
+        // root 兜底合并为一次往返（避免权限问题）：initstate == live，
+        // 或 /proc/modules 存在条目，或 /sys/module/<name> 与其 parameters 目录均存在（减少误报）
         try {
-            val procRes = RootShell.exec("cat /proc/modules | grep -E '^${moduleName}\\s' | wc -l")
-            val count = procRes.out.trim().toIntOrNull() ?: 0
-            if (procRes.code == 0 && count > 0) return@withContext true
-        } catch (_: Throwable) {
-            // ignore and fallback
-        }
-
-        // 最后保守检查：/sys/module/<name> 目录是否存在 且 parameters 目录存在（减少误报）
-        try {
-            val res = RootShell.exec("[ -d '$sysModuleBase/$moduleName' ] && [ -d '$sysModuleBase/$moduleName/parameters' ] && echo live || echo not")
+            val base = "$sysModuleBase/$moduleName"
+            val res = RootShell.exec(
+                "if [ \"\$(cat '$base/initstate' 2>/dev/null)\" = live ] || " +
+                "grep -qE '^${moduleName}\\s' /proc/modules 2>/dev/null || " +
+                "{ [ -d '$base' ] && [ -d '$base/parameters' ]; }; then echo live; else echo not; fi"
+            )
             if (res.code == 0 && res.out.trim() == "live") return@withContext true
         } catch (_: Throwable) {
             // ignore
@@ -255,19 +241,41 @@ class ModuleManager(
         return@withContext if (res.code == 0 && res.out.isNotBlank()) res.out.trim() else null
     }
 
-    suspend fun readAll(): Map<String,String?> {
-        val map = mutableMapOf<String,String?>()
-        for (p in paramNames) map[p] = readParam(p)
-        return map
+    /** 读取全部参数：可直接读的走普通文件，其余合并为一次 root 往返 */
+    suspend fun readAll(): Map<String,String?> = withContext(Dispatchers.IO) {
+        val start = android.os.SystemClock.elapsedRealtime()
+        val trips = RootShell.roundTrips.get()
+        val map = linkedMapOf<String,String?>()
+        val viaRoot = mutableListOf<String>()
+        for (p in paramNames) {
+            val v = runCatching { File(paramPath(p)).takeIf { it.exists() }?.readText()?.trim() }.getOrNull()
+            map[p] = v
+            if (v == null) viaRoot += p
+        }
+        if (viaRoot.isNotEmpty()) {
+            val results = RootShell.execBatch(viaRoot.map { "cat ${shellQuoteIfNeeded(paramPath(it))} 2>/dev/null" })
+            viaRoot.forEachIndexed { i, p ->
+                val res = results[i]
+                map[p] = if (res.code == 0 && res.out.isNotBlank()) res.out.trim() else null
+            }
+        }
+        android.util.Log.d("ModuleManager", "readAll: ${paramNames.size} params in ${android.os.SystemClock.elapsedRealtime() - start} ms, root round trips=${RootShell.roundTrips.get() - trips}")
+        map
     }
 
-    suspend fun writeParam(param: String, value: String): Boolean {
-        val path = paramPath(param)
-        if (!File(path).exists()) return false
+    suspend fun writeParam(param: String, value: String): Boolean =
+        writeParams(listOf(param to value)) == 1
+
+    /** 批量写参数（一次 root 往返），返回成功条数；不存在的参数跳过 */
+    suspend fun writeParams(values: List<Pair<String,String>>): Int = withContext(Dispatchers.IO) {
+        val present = values.filter { File(paramPath(it.first)).exists() }
+        if (present.isEmpty()) return@withContext 0
         // 先尝试常规重定向；失败则使用 tee 兜底（某些环境下重定向可能因上下文导致失败）
-        val cmd = "printf %s ${shellQuote(value)} > ${shellQuoteIfNeeded(path)} 2>/dev/null || (echo ${shellQuote(value)} | tee ${shellQuoteIfNeeded(path)} >/dev/null)"
-        val res = RootShell.exec(cmd)
-        return res.code == 0
+        val cmds = present.map { (param, value) ->
+            val path = paramPath(param)
+            "printf %s ${shellQuote(value)} > ${shellQuoteIfNeeded(path)} 2>/dev/null || (echo ${shellQuote(value)} | tee ${shellQuoteIfNeeded(path)} >/dev/null)"
+        }
+        RootShell.execBatch(cmds).count { it.code == 0 }
     }
 
     suspend fun load(koPath: String, initial: Map<String,String?>): RootShell.ExecResult {
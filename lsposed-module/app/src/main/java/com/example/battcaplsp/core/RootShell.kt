@@ -5,10 +5,14 @@ import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.delay
 import kotlinx.coroutines.withContext
 import kotlinx.coroutines.withTimeoutOrNull
+import java.util.concurrent.atomic.AtomicLong
 
 /**
  * 优化的 Root Shell 助手
  * 包含重试机制和更可靠的权限检测逻辑
+ *
+ * 所有命令复用同一个常驻 root 会话（libsu 主 Shell），会话退出时自动重建；
+ * [execBatch] 将多条命令合并为一次往返，并按请求编号拆分各自的 stdout/stderr/退出码。
  */
 object RootShell {
     private var lastCheckTime = 0L
@@ -147,16 +151,11 @@ object RootShell {
             val infoCommands = listOf("id", "whoami", "getenforce 2>/dev/null || echo 'SELinux: Unknown'")
             val infoResults = mutableListOf<String>()
             
-            for (cmd in infoCommands) {
-                try {
-                    val result = withTimeoutOrNull(2000) {
-                        Shell.cmd(cmd).exec()
-                    }
-                    if (result?.isSuccess == true && result.out.isNotEmpty()) {
-                        infoResults.addAll(result.out)
-                    }
-                } catch (e: Exception) {
-                    // 忽略单个命令的错误
+            // 合并为一次往返
+            val batch = withTimeoutOrNull(2000) { execBatch(infoCommands) }.orEmpty()
+            for (result in batch) {
+                if (result.code == 0 && result.out.isNotEmpty()) {
+                    infoResults.addAll(result.out.split('\n'))
                 }
             }
             
@@ -180,15 +179,100 @@ object RootShell {
         lastCheckTime = 0L
     }
 
+    /** 自进程启动以来的 root 往返次数，用于对比界面加载开销 */
+    val roundTrips = AtomicLong(0)
+    private val batchSeq = AtomicLong(0)
+
+    /** 常驻 root 会话；su 进程已退出（被杀/超时）时关闭旧会话并重建 */
+    private fun session(): Shell {
+        Shell.getCachedShell()?.let { cached ->
+            if (cached.isAlive) return cached
+            runCatching { cached.close() }
+        }
+        return Shell.getShell()
+    }
+
+    /** 在常驻会话上执行一次作业；会话中途死亡导致作业未执行时重建会话重试一次 */
+    private fun runJob(script: String, out: MutableList<String>, err: MutableList<String>): Int {
+        var code = Shell.Result.JOB_NOT_EXECUTED
+        for (attempt in 0 until 2) {
+            out.clear(); err.clear()
+            code = session().newJob().add(script).to(out, err).exec().code
+            roundTrips.incrementAndGet()
+            if (code != Shell.Result.JOB_NOT_EXECUTED) break
+        }
+        return code
+    }
+
     suspend fun exec(cmd: String): ExecResult = withContext(Dispatchers.IO) {
         return@withContext try {
-            val res = Shell.cmd(cmd).exec()
-            ExecResult(res.code, res.out.joinToString("\n"), res.err.joinToString("\n"))
+            val out = mutableListOf<String>()
+            val err = mutableListOf<String>()
+            val code = runJob(cmd, out, err)
+            ExecResult(code, out.joinToString("\n"), err.joinToString("\n"))
         } catch (t: Throwable) {
             ExecResult(-1, "", t.message ?: "error")
         }
     }
 
+    /**
+     * 一次往返执行多条命令，结果与 [cmds] 一一对应。
+     * 每条命令在子 shell 中运行（互不影响 cd/exit），前后在 stdout 与 stderr 上各写入
+     * 带批次编号的起止标记，据此拆分输出；结束标记携带该命令的退出码。
+     */
+    suspend fun execBatch(cmds: List<String>): List<ExecResult> = withContext(Dispatchers.IO) {
+        if (cmds.isEmpty()) return@withContext emptyList()
+        val prefix = "__RS_${android.os.Process.myPid()}_${batchSeq.incrementAndGet()}_"
+        val script = buildString {
+            cmds.forEachIndexed { i, c ->
+                append("echo ${prefix}${i}_B; echo ${prefix}${i}_B >&2\n")
+                append("(\n").append(c).append("\n)\n")
+                append("echo ${prefix}${i}_E \$?; echo ${prefix}${i}_E >&2\n")
+            }
+        }
+        try {
+            val out = mutableListOf<String>()
+            val err = mutableListOf<String>()
+            val jobCode = runJob(script, out, err)
+            val outs = demux(out, prefix, cmds.size)
+            val errs = demux(err, prefix, cmds.size)
+            cmds.indices.map { i ->
+                val code = outs.codes[i] ?: if (jobCode == 0) -1 else jobCode
+                ExecResult(code, outs.text[i].joinToString("\n"), errs.text[i].joinToString("\n"))
+            }
+        } catch (t: Throwable) {
+            List(cmds.size) { ExecResult(-1, "", t.message ?: "error") }
+        }
+    }
+
+    private class Demuxed(n: Int) {
+        val text = Array(n) { mutableListOf<String>() }
+        val codes = arrayOfNulls<Int>(n)
+    }
+
+    private fun demux(lines: List<String>, prefix: String, n: Int): Demuxed {
+        val d = Demuxed(n)
+        var cur = -1
+        for (line in lines) {
+            val at = line.indexOf(prefix)
+            if (at < 0) {
+                if (cur >= 0) d.text[cur].add(line)
+                continue
+            }
+            // 命令输出末尾无换行时标记会拼在同一行
+            if (at > 0 && cur >= 0) d.text[cur].add(line.substring(0, at))
+            val rest = line.substring(at + prefix.length)
+            val idx = rest.substringBefore('_').toIntOrNull()?.takeIf { it in 0 until n } ?: continue
+            if (rest.substringAfter('_').startsWith("B")) {
+                cur = idx
+            } else {
+                d.codes[idx] = rest.substringAfter(' ', "").trim().toIntOrNull()
+                cur = -1
+            }
+        }
+        return d
+    }
+
     fun shellArg(s: String): String = "'" + s.replace("'", "'\\''") + "'"
 
     data class ExecResult(val code: Int, val out: String, val err: String) {
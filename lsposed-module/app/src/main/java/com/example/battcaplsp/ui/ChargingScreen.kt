@@ -33,6 +33,8 @@ fun ChargingScreen(repo: ChgParamRepository, mgr: ChgModuleManager) {
     var verbose by remember { mutableStateOf(ui.verbose) }
     var msg by remember { mutableStateOf("") }
     var kernelLog by remember { mutableStateOf("") }
+    // 最近一次读取到的内核配置代数，保存时用于 compare-and-swap
+    var kernelGen by remember { mutableStateOf<Long?>(null) }
 
     Column(Modifier.padding(12.dp).verticalScroll(rememberScrollState())) {
         Text("充电模块: ${if (ui.loaded) "已加载" else "未加载"}", style = MaterialTheme.typography.titleMedium)
@@ -82,8 +84,14 @@ fun ChargingScreen(repo: ChgParamRepository, mgr: ChgModuleManager) {
                             "term" to ((term.text.trim().ifEmpty { "0" }.toDoubleOrNull() ?: 0.0) * 1000).toLong().toString(),
                             "icl" to ((icl.text.trim().ifEmpty { "0" }.toDoubleOrNull() ?: 0.0) * 1000).toLong().toString(),
                             "charge_limit" to limit.text.trim()
-                        ))
+                        ), expectedGen = kernelGen)
+                        if (mgr.isStaleGeneration(applyRes)) {
+                            kernelGen = null
+                            msg = "WARN:内核参数已被其它写入者修改，请先读取当前参数再保存"; OpEvents.warn("充电:配置代数冲突")
+                            return@launch
+                        }
                         if (applyRes.code == 0) {
+                            kernelGen = kernelGen?.plus(1)
                             ConfigSync.syncChg(
                                 context,
                                 batt.text.trim(), usb.text.trim(),
@@ -175,6 +183,7 @@ fun ChargingScreen(repo: ChgParamRepository, mgr: ChgModuleManager) {
                     m["term"]?.toLongOrNull()?.let { term = TextFieldValue((it / 1000).toString()) }
                     m["icl"]?.toLongOrNull()?.let { icl = TextFieldValue((it / 1000).toString()) }
                     m["charge_limit"]?.toIntOrNull()?.let { limit = TextFieldValue(it.toString()) }
+                    kernelGen = m["gen"]?.toLongOrNull()
                     msg = "SUCCESS:当前参数读取成功"; OpEvents.success("充电:读取当前参数成功")
                 } catch (t: Throwable) {
                     msg = "ERROR:读取参数异常 ${t.message}"; OpEvents.error("充电:读取参数异常 ${t.message}")
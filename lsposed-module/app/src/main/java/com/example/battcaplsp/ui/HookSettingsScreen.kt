@@ -955,7 +955,7 @@ fun HookSettingsScreen(repo: HookSettingsRepository) {
                                         moduleDownloadProgress = 0
                                         moduleManagementMessage = "正在重新下载 ${moduleInfo.name} (忽略本地缓存)..."
 
-                                        val result = downloader.downloadModule(moduleInfo) { progress ->
+                                        val result = downloader.forceRedownload(moduleInfo) { progress ->
                                             moduleDownloadProgress = progress
                                         }
 
@@ -263,8 +263,7 @@ class MainActivity: ComponentActivity() {
                                     Pair("override_any", if (overrideAny) "1" else "0"),
                                     Pair("verbose", if (verbose) "1" else "0")
                                 )
-                                var okCnt = 0
-                                for ((k,v) in tasks) if (v.isNotEmpty()) if (battMgr.writeParam(k, v)) okCnt++
+                                val okCnt = battMgr.writeParams(tasks.filter { it.second.isNotEmpty() })
                                 com.override.battcaplsp.core.ConfigSync.syncBatt(
                                     context,
                                     battName.text.trim(),
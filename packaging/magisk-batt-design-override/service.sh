@@ -7,6 +7,9 @@
 #   DESIGN_UWH   -> design_uwh=<val>
 #   OVERRIDE_ANY -> override_any=1|0
 #   BATT_NAME    -> batt_name=<val>
+#   OVERRIDES    -> overrides=<sel:key=val,...;...>（多电源覆盖集）
+#   CACHE_ENABLE -> cache_enable=1|0（慢属性读缓存）
+#   CACHE_TTL    -> cache_ttl=<name=ms,...>
 #   VERBOSE      -> verbose=1|0
 #
 # 可通过创建 /data/adb/modules/batt-design-override/disable_autoload 标记文件禁用自动加载。
@@ -142,6 +145,9 @@ ARGS=""
 [ -n "$DESIGN_UWH" ] && ARGS="$ARGS design_uwh=$DESIGN_UWH"
 [ -n "$BATT_NAME" ] && ARGS="$ARGS batt_name=$BATT_NAME"
 [ -n "$OVERRIDE_ANY" ] && ARGS="$ARGS override_any=$OVERRIDE_ANY"
+[ -n "$OVERRIDES" ] && ARGS="$ARGS overrides=$OVERRIDES"
+[ -n "$CACHE_ENABLE" ] && ARGS="$ARGS cache_enable=$CACHE_ENABLE"
+[ -n "$CACHE_TTL" ] && ARGS="$ARGS cache_ttl=$CACHE_TTL"
 [ -n "$VERBOSE" ] && ARGS="$ARGS verbose=$VERBOSE"
 
 # 去掉前导空格